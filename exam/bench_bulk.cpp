@@ -0,0 +1,86 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// ingesting batches with push_range/pop_n against a loop of push/pop, on a
+// fresh pool (never used nodes) and on a warm one (recycled nodes). Every
+// measure gets its own pool, so that they all start from the same state.
+
+constexpr std::size_t n = std::size_t(1) << 22;
+constexpr std::size_t batch = 256;
+
+template <typename N>
+struct run {
+  using pool_type = stack_pool<int, N>;
+  std::vector<int> in, out;
+  run() : in(batch), out(batch) { std::iota(in.begin(), in.end(), 0); }
+
+  N fill(pool_type& pool, N l, const bool bulk) {
+    for (std::size_t i = 0; i < n; i += batch)
+      if (bulk)
+        l = pool.push_range(in.begin(), in.end(), l);
+      else
+        for (auto x : in)
+          l = pool.push(x, l);
+    return l;
+  }
+
+  N drain(pool_type& pool, N l, const bool bulk) {
+    for (std::size_t i = 0; i < n; i += batch)
+      if (bulk)
+        l = pool.pop_n(l, batch, out.begin());
+      else
+        for (auto& x : out) {
+          x = pool.value(l);
+          l = pool.pop(l);
+        }
+    return l;
+  }
+
+  // ns per value
+  double push(const bool bulk, const bool warm) {
+    pool_type pool;
+    auto l = pool.new_stack();
+    if (warm)
+      l = pool.free_stack(fill(pool, l, true));
+    timer<> t;
+    t.start();
+    fill(pool, l, bulk);
+    return t.stop() * 1e9 / n;
+  }
+
+  double pop(const bool bulk) {
+    pool_type pool;
+    auto l = fill(pool, pool.new_stack(), true);
+    timer<> t;
+    t.start();
+    drain(pool, l, bulk);
+    return t.stop() * 1e9 / n;
+  }
+};
+
+template <typename N>
+void bench(const std::string& name) {
+  run<N> r;
+  std::cout << std::setw(10) << name << std::setw(14) << r.push(false, false)
+            << std::setw(14) << r.push(true, false) << std::setw(14)
+            << r.push(false, true) << std::setw(14) << r.push(true, true)
+            << std::setw(14) << r.pop(false) << std::setw(14) << r.pop(true)
+            << std::endl;
+}
+
+int main() {
+  std::cout << n << " values in batches of " << batch << ", ns per value"
+            << std::endl;
+  std::cout << std::setw(10) << "N" << std::setw(14) << "push"
+            << std::setw(14) << "push_range" << std::setw(14) << "push warm"
+            << std::setw(14) << "range warm" << std::setw(14) << "pop"
+            << std::setw(14) << "pop_n" << std::endl;
+  bench<std::uint32_t>("uint32");
+  bench<std::size_t>("size_t");
+}
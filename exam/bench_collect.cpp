@@ -0,0 +1,32 @@
+#include "stack_pool.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// collect on a pool where half of the stacks have been lost: the time of the
+// whole mark and sweep, by the number of threads that mark. The stacks are
+// pushed round robin, so every walk jumps around the pool.
+
+using N = std::uint32_t;
+constexpr std::size_t n_stacks = 4096;
+
+int main(int argc, char* argv[]) {
+  const std::size_t n = argc > 1 ? std::stoul(argv[1]) : std::size_t(1) << 24;
+  std::cout << n << " nodes in " << n_stacks << " stacks, half of them lost"
+            << std::endl;
+  std::cout << std::setw(10) << "threads" << std::setw(14) << "reclaimed"
+            << std::setw(14) << "time [ms]" << std::setw(14) << "ns/node"
+            << std::endl;
+  for (unsigned threads = 1; threads <= 16; threads *= 2) {
+    stack_pool<int, N> pool{n};
+    std::vector<N> heads(n_stacks, pool.new_stack());
+    for (std::size_t i = 0; i < n; ++i)
+      heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+    heads.resize(n_stacks / 2);
+    const auto c = pool.collect(heads.begin(), heads.end(), threads);
+    std::cout << std::setw(10) << threads << std::setw(14) << c.reclaimed
+              << std::setw(14) << c.seconds * 1e3 << std::setw(14)
+              << c.seconds * 1e9 / n << std::endl;
+  }
+}
@@ -0,0 +1,86 @@
+#include "concurrent_stack_pool.hpp"
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// every thread owns a few stacks and keeps growing and shrinking them, so the
+// only thing the threads share is the pool itself
+
+constexpr std::size_t n_stacks = 16;
+constexpr std::size_t depth = 64;
+constexpr std::size_t rounds = 2000;
+
+struct locked_pool {
+  stack_pool<int> pool;
+  std::mutex m;
+  std::size_t push(int v, std::size_t h) {
+    std::lock_guard<std::mutex> lock{m};
+    return pool.push(v, h);
+  }
+  std::size_t pop(std::size_t h) {
+    std::lock_guard<std::mutex> lock{m};
+    return pool.pop(h);
+  }
+};
+
+// a thread_cache per thread in front of the lock-free pool
+struct cached_pool {
+  concurrent_stack_pool<int> pool;
+};
+
+template <typename P>
+void worker(P& pool) {
+  std::size_t heads[n_stacks] = {};
+  for (std::size_t r = 0; r < rounds; ++r) {
+    for (std::size_t i = 0; i < depth; ++i)
+      heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+    for (std::size_t i = 0; i < depth; ++i)
+      heads[i % n_stacks] = pool.pop(heads[i % n_stacks]);
+  }
+}
+
+template <typename P>
+void work(P& pool) {
+  worker(pool);
+}
+
+void work(cached_pool& p) {
+  concurrent_stack_pool<int>::thread_cache cache{p.pool};
+  worker(cache);
+}
+
+// returns ns per push or pop
+template <typename P>
+double run(P& pool, const unsigned n_threads) {
+  timer<> t;
+  t.start();
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < n_threads; ++i)
+    threads.emplace_back([&pool] { work(pool); });
+  for (auto& th : threads)
+    th.join();
+  const double ops = 2.0 * depth * rounds * n_threads;
+  return t.stop() * 1e9 / ops;
+}
+
+int main() {
+  const unsigned max_threads =
+      std::max(2 * std::thread::hardware_concurrency(), 2u);
+  std::cout << std::setw(10) << "threads" << std::setw(18) << "mutex [ns/op]"
+            << std::setw(18) << "lock-free [ns/op]" << std::setw(18)
+            << "cached [ns/op]" << std::endl;
+  for (unsigned n = 1; n <= max_threads; n *= 2) {
+    locked_pool lp;
+    concurrent_stack_pool<int> cp;
+    cached_pool tp;
+    const auto tl = run(lp, n);
+    const auto tc = run(cp, n);
+    const auto tt = run(tp, n);
+    std::cout << std::setw(10) << n << std::setw(18) << tl << std::setw(18)
+              << tc << std::setw(18) << tt << std::endl;
+  }
+}
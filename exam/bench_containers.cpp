@@ -0,0 +1,270 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <forward_list>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <stack>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the List of the lecture on copy and move semantics, in a namespace of its
+// own because its _iterator is not ours, and with its main renamed (the
+// headers it includes are already in): the renamed main returns nothing
+namespace lecture {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#define main as_linked_list_main
+#include "../c++/05_copy_move_semantics/exercises/as_linked_list.cpp"
+#undef main
+#pragma GCC diagnostic pop
+}  // namespace lecture
+
+// stack_pool against the containers one would use instead, for many stacks at
+// once: n values are pushed round robin on s stacks, every stack is walked,
+// half of the values are popped round robin and the rest is freed stack by
+// stack. Times are in ns per value touched by the phase, the peak resident set
+// covers the whole run. Every run is a process of its own, forked, so that
+// its peak is not the one of the run before it. The List has no pop: its pop
+// column is empty and it frees all the values, recursively, one call per node:
+// the child runs with the stack limit raised to the hard one, a long List
+// still overflows it if the hard limit is low.
+// The output is CSV, one line per run.
+
+volatile std::size_t sink;
+
+// a value as wide as a cache line
+struct wide {
+  std::uint64_t v[8];
+  explicit wide(const std::size_t x = 0) : v{x} {}
+};
+
+template <typename T>
+T make(const std::size_t i) {
+  return T(i);
+}
+template <typename T>
+std::size_t key(const T& x) {
+  return std::size_t(x);
+}
+std::size_t key(const wide& x) {
+  return std::size_t(x.v[0]);
+}
+
+template <typename T>
+const char* name_of();
+template <>
+const char* name_of<std::uint32_t>() {
+  return "uint32";
+}
+template <>
+const char* name_of<std::uint64_t>() {
+  return "uint64";
+}
+template <>
+const char* name_of<wide>() {
+  return "wide";
+}
+
+// the same four operations on every container: the heads are whatever a
+// stack is made of, new_stack, push, pop, walk and free work on one of them
+
+template <typename T, typename N>
+struct pool_stacks {
+  stack_pool<T, N> pool;
+  std::vector<N> heads;
+  explicit pool_stacks(const std::size_t s) : heads(s, pool.new_stack()) {}
+  void push(const std::size_t i, const T& x) { heads[i] = pool.push(x, heads[i]); }
+  void pop(const std::size_t i) { heads[i] = pool.pop(heads[i]); }
+  std::size_t walk(const std::size_t i) const {
+    std::size_t s = 0;
+    for (auto x = pool.cbegin(heads[i]); x != pool.cend(heads[i]); ++x)
+      s += key(*x);
+    return s;
+  }
+  void free(const std::size_t i) { heads[i] = pool.free_stack(heads[i]); }
+};
+
+template <typename T>
+struct std_stacks {
+  // std::stack hides its container, the walk needs it
+  struct stack : std::stack<T, std::vector<T>> {
+    using std::stack<T, std::vector<T>>::c;
+  };
+  std::vector<stack> heads;
+  explicit std_stacks(const std::size_t s) : heads(s) {}
+  void push(const std::size_t i, const T& x) { heads[i].push(x); }
+  void pop(const std::size_t i) { heads[i].pop(); }
+  std::size_t walk(const std::size_t i) const {
+    std::size_t s = 0;
+    for (auto x = heads[i].c.rbegin(); x != heads[i].c.rend(); ++x)
+      s += key(*x);
+    return s;
+  }
+  void free(const std::size_t i) { stack{}.c.swap(heads[i].c); }
+};
+
+template <typename L>
+struct list_stacks {
+  std::vector<L> heads;
+  list_stacks() = default;
+  explicit list_stacks(const std::size_t s) : heads(s) {}
+  void push(const std::size_t i, const typename L::value_type& x) {
+    heads[i].push_front(x);
+  }
+  void pop(const std::size_t i) { heads[i].pop_front(); }
+  std::size_t walk(const std::size_t i) const {
+    std::size_t s = 0;
+    for (const auto& x : heads[i])
+      s += key(x);
+    return s;
+  }
+  void free(const std::size_t i) { heads[i].clear(); }
+};
+
+template <typename T>
+using forward_lists = list_stacks<std::forward_list<T>>;
+
+// the nodes of every list come from the same pool
+template <typename T>
+struct pmr_lists : list_stacks<std::pmr::forward_list<T>> {
+  std::pmr::unsynchronized_pool_resource nodes;
+  explicit pmr_lists(const std::size_t s) {
+    this->heads.reserve(s);
+    for (std::size_t i = 0; i < s; ++i)
+      this->heads.emplace_back(&nodes);
+  }
+};
+
+template <typename T>
+struct lecture_lists {
+  static constexpr bool has_pop = false;
+  std::vector<lecture::List<T>> heads;
+  explicit lecture_lists(const std::size_t s) : heads(s) {}
+  void push(const std::size_t i, const T& x) {
+    heads[i].insert(x, lecture::method::push_front);
+  }
+  std::size_t walk(const std::size_t i) const {
+    std::size_t s = 0;
+    for (const auto& x : heads[i])
+      s += key(x);
+    return s;
+  }
+  void free(const std::size_t i) { heads[i] = lecture::List<T>{}; }
+};
+
+template <typename C>
+constexpr bool has_pop(...) {
+  return true;
+}
+template <typename C>
+constexpr bool has_pop(decltype(C::has_pop)*) {
+  return C::has_pop;
+}
+
+// peak resident set in kB, from /proc (0 where it is not available)
+std::size_t peak_rss() {
+  std::ifstream status{"/proc/self/status"};
+  std::string field;
+  std::size_t kb = 0;
+  while (status >> field)
+    if (field == "VmHWM:") {
+      status >> kb;
+      break;
+    }
+  return kb;
+}
+
+template <typename C, typename T>
+void run(const std::string& container, const std::string& n_name,
+         const std::size_t s, const std::size_t n) {
+  timer<> t;
+  double ns[4];
+  std::size_t popped = 0;
+  {
+    C c{s};
+    t.start();
+    for (std::size_t i = 0; i < n; ++i)
+      c.push(i % s, make<T>(i));
+    ns[0] = t.stop() * 1e9 / n;
+
+    t.start();
+    std::size_t sum = 0;
+    for (std::size_t i = 0; i < s; ++i)
+      sum += c.walk(i);
+    ns[1] = t.stop() * 1e9 / n;
+    sink = sum;
+
+    if constexpr (has_pop<C>(nullptr)) {
+      popped = n / 2;
+      t.start();
+      for (std::size_t i = 0; i < popped; ++i)
+        c.pop(i % s);
+      ns[2] = t.stop() * 1e9 / popped;
+    }
+
+    t.start();
+    for (std::size_t i = 0; i < s; ++i)
+      c.free(i);
+    ns[3] = t.stop() * 1e9 / (n - popped);
+  }
+  std::cout << container << ',' << name_of<T>() << ',' << sizeof(T) << ','
+            << n_name << ',' << s << ',' << n << ',' << ns[0] << ',' << ns[1]
+            << ',';
+  if (popped)
+    std::cout << ns[2];
+  std::cout << ',' << ns[3] << ',' << peak_rss() << std::endl;
+}
+
+// in a child, the parent waits for it
+template <typename C, typename T>
+void fork_run(const std::string& container, const std::string& n_name,
+              const std::size_t s, const std::size_t n) {
+  std::cout.flush();
+  const auto pid = fork();
+  if (pid == 0) {
+    rlimit stack;
+    if (getrlimit(RLIMIT_STACK, &stack) == 0) {
+      stack.rlim_cur = stack.rlim_max;
+      setrlimit(RLIMIT_STACK, &stack);
+    }
+    run<C, T>(container, n_name, s, n);
+    std::exit(0);
+  }
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    std::cerr << container << ", " << s << " stacks: cannot run" << std::endl;
+  else if (WIFSIGNALED(status))
+    std::cerr << container << ", " << name_of<T>() << ", " << s
+              << " stacks: killed by signal " << WTERMSIG(status) << std::endl;
+}
+
+template <typename T>
+void bench(const std::size_t s, const std::size_t n) {
+  fork_run<pool_stacks<T, std::uint32_t>, T>("stack_pool", "uint32", s, n);
+  fork_run<pool_stacks<T, std::uint64_t>, T>("stack_pool", "uint64", s, n);
+  fork_run<std_stacks<T>, T>("std::stack", "", s, n);
+  fork_run<forward_lists<T>, T>("std::forward_list", "", s, n);
+  fork_run<pmr_lists<T>, T>("std::pmr::forward_list", "", s, n);
+  fork_run<lecture_lists<T>, T>("List", "", s, n);
+}
+
+int main(int argc, char* argv[]) {
+  const std::size_t n = argc > 1 ? std::stoul(argv[1]) : std::size_t(1000000);
+  std::cout << "container,T,sizeof(T),N,stacks,values,push [ns],walk [ns],"
+               "pop [ns],free [ns],peak rss [kB]"
+            << std::endl;
+  for (std::size_t s = 1; s <= n; s *= 10) {
+    bench<std::uint32_t>(s, n);
+    bench<std::uint64_t>(s, n);
+    bench<wide>(s, n);
+  }
+}
@@ -0,0 +1,77 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// which free node a push gets: the LIFO list against the bitmap. Stacks are
+// filled round robin and half of the nodes are freed, either as whole stacks
+// or by popping the tops at random; then new stacks are pushed one after the
+// other on the holes and walked. frag is the fragmentation of the new stacks.
+
+using N = std::uint32_t;
+constexpr std::size_t n_stacks = 1024;
+constexpr std::size_t n_nodes = std::size_t(1) << 21;
+volatile std::size_t sink;
+
+template <typename P>
+void bench(const std::string& name, const bool whole) {
+  P pool{n_nodes};
+  std::vector<N> heads(n_stacks, pool.new_stack());
+  for (std::size_t i = 0; i < n_nodes; ++i)
+    heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+
+  if (whole)
+    for (std::size_t i = 0; i < n_stacks; i += 2)
+      heads[i] = pool.free_stack(heads[i]);
+  else {
+    std::uint32_t r = 12345;  // the same sequence for every pool
+    for (std::size_t i = 0; i < n_nodes / 2; ++i) {
+      std::size_t k;
+      do {
+        r = r * 1664525 + 1013904223;
+        k = r >> 22;
+      } while (pool.empty(heads[k]));
+      heads[k] = pool.pop(heads[k]);
+    }
+  }
+
+  timer<> t;
+  std::vector<N> fresh(n_stacks / 2, pool.new_stack());
+  const auto length = n_nodes / 2 / fresh.size();
+  t.start();
+  for (auto& h : fresh)
+    for (std::size_t i = 0; i < length; ++i)
+      h = pool.push(int(i), h);
+  const auto t_push = t.stop() * 1e9 / (length * fresh.size());
+
+  t.start();
+  std::size_t hops = 0;
+  for (auto h : fresh)
+    for (auto x = h; !pool.empty(x); x = pool.next(x))
+      ++hops;
+  const auto t_walk = t.stop() * 1e9 / hops;
+  sink = hops;
+
+  std::cout << std::setw(24) << name << std::setw(14) << t_push
+            << std::setw(14) << t_walk << std::setw(10)
+            << pool.fragmentation(fresh.begin(), fresh.end()) << std::endl;
+}
+
+using lifo = stack_pool<int, N>;
+using bitmap = stack_pool<int, N, vector_storage, vector_storage::growth,
+                          bitmap_free_slots>;
+
+int main() {
+  std::cout << n_stacks << " stacks, " << n_nodes << " nodes, ns per node"
+            << std::endl;
+  std::cout << std::setw(24) << "free nodes" << std::setw(14) << "push"
+            << std::setw(14) << "walk" << std::setw(10) << "frag"
+            << std::endl;
+  bench<lifo>("lifo, whole stacks", true);
+  bench<bitmap>("bitmap, whole stacks", true);
+  bench<lifo>("lifo, random pops", false);
+  bench<bitmap>("bitmap, random pops", false);
+}
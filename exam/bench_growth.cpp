@@ -0,0 +1,87 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// push n values on a pool that starts empty, the worst push is the one that
+// triggers the largest growth, the waste is the capacity left unused at the end,
+// growths and moved come from the counters of the pool
+
+template <typename P>
+void bench(const std::string& name, const std::size_t n) {
+  using clock = std::chrono::steady_clock;
+  P pool;
+  auto l = pool.new_stack();
+  double worst = 0;
+  timer<> total;
+  total.start();
+  for (std::size_t i = 0; i < n; ++i) {
+    const auto t0 = clock::now();
+    l = pool.push(int(i), l);
+    const auto dt = std::chrono::duration<double>(clock::now() - t0).count();
+    worst = std::max(worst, dt);
+  }
+  const auto t = total.stop();
+  const auto waste = 100.0 * (pool.capacity() - n) / pool.capacity();
+  const auto& c = pool.counters();
+  std::cout << std::setw(20) << name << std::setw(18) << t * 1e9 / n
+            << std::setw(18) << worst * 1e3 << std::setw(12) << waste
+            << std::setw(10) << c.growths << std::setw(14)
+            << double(c.bytes_moved) / (1 << 20) << std::endl;
+}
+
+// resident set size in MB, from /proc (0 where it is not available)
+double rss() {
+  std::ifstream statm{"/proc/self/statm"};
+  double pages = 0;
+  statm >> pages >> pages;
+  return pages * 4096 / (1 << 20);
+}
+
+// reserving is not using: both the time and the memory actually touched
+// should not depend on the reserved size
+template <typename P>
+void bench_reserve(const std::string& name, const std::size_t n) {
+  const auto rss0 = rss();
+  timer<> t;
+  t.start();
+  P pool{n};
+  const auto t_reserve = t.stop();
+  auto l = pool.new_stack();
+  for (int i = 0; i < 1000; ++i)
+    l = pool.push(i, l);
+  std::cout << std::setw(20) << name << std::setw(18) << t_reserve * 1e3
+            << std::setw(18) << rss() - rss0 << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  const std::size_t n = argc > 1 ? std::stoul(argv[1]) : std::size_t(6000000);
+  std::cout << "pushing " << n << " nodes" << std::endl;
+  std::cout << std::setw(20) << "storage" << std::setw(18) << "push [ns/op]"
+            << std::setw(18) << "worst push [ms]" << std::setw(12)
+            << "waste [%]" << std::setw(10) << "growths" << std::setw(14)
+            << "moved [MB]" << std::endl;
+  bench<stack_pool<int>>("vector", n);
+  bench<stack_pool<int, std::size_t, chunked_storage<12>>>("chunked<12>", n);
+  bench<stack_pool<int, std::size_t, chunked_storage<16>>>("chunked<16>", n);
+
+  std::cout << "\ngrowth policies on vector_storage" << std::endl;
+  using S = vector_storage;
+  bench<stack_pool<int, std::size_t, S, geometric_growth<2>>>("x2", n);
+  bench<stack_pool<int, std::size_t, S, geometric_growth<3, 2>>>("x1.5", n);
+  bench<stack_pool<int, std::size_t, S, geometric_growth<5, 4>>>("x1.25", n);
+  bench<stack_pool<int, std::size_t, S, linear_growth<(1 << 20)>>>("+2^20", n);
+  bench<stack_pool<int, std::size_t, S, capped_growth<6000000>>>(
+      "x2 capped at 6e6", n);
+
+  std::cout << "\nreserving " << 16 * n << " nodes, then pushing 1000"
+            << std::endl;
+  std::cout << std::setw(20) << "storage" << std::setw(18) << "reserve [ms]"
+            << std::setw(18) << "rss [MB]" << std::endl;
+  bench_reserve<stack_pool<int>>("vector", 16 * n);
+  bench_reserve<stack_pool<int, std::size_t, soa_storage>>("soa", 16 * n);
+}
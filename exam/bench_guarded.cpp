@@ -0,0 +1,56 @@
+#include "guarded_stack_pool.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// what the generation check costs: the same work on a stack_pool and on a
+// guarded_stack_pool, the handles of the second one are checked by every
+// push, pop, value and next
+
+constexpr std::size_t n_stacks = 64;
+constexpr std::size_t n_nodes = std::size_t(1) << 22;
+volatile long sink;
+
+template <typename P>
+void bench(const std::string& name) {
+  using H = typename std::decay<decltype(P{}.new_stack())>::type;
+  P pool{n_nodes};
+  std::vector<H> heads(n_stacks, pool.new_stack());
+  timer<> t;
+  double ns[3];
+
+  t.start();
+  for (std::size_t i = 0; i < n_nodes; ++i)
+    heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+  ns[0] = t.stop() * 1e9 / n_nodes;
+
+  t.start();
+  long s = 0;
+  for (auto h : heads)
+    for (auto x = h; !pool.empty(x); x = pool.next(x))
+      s += pool.value(x);
+  ns[1] = t.stop() * 1e9 / n_nodes;
+  sink = s;
+
+  t.start();
+  for (std::size_t i = 0; i < n_nodes; ++i)
+    heads[i % n_stacks] = pool.pop(heads[i % n_stacks]);
+  ns[2] = t.stop() * 1e9 / n_nodes;
+
+  std::cout << std::setw(12) << name;
+  for (auto x : ns)
+    std::cout << std::setw(14) << x;
+  std::cout << std::endl;
+}
+
+int main() {
+  std::cout << n_stacks << " stacks, " << n_nodes << " nodes, ns per node"
+            << std::endl;
+  std::cout << std::setw(12) << "pool" << std::setw(14) << "push"
+            << std::setw(14) << "walk" << std::setw(14) << "pop" << std::endl;
+  bench<maybe_guarded_stack_pool<false, int, std::uint32_t>>("plain");
+  bench<maybe_guarded_stack_pool<true, int, std::uint32_t>>("guarded");
+}
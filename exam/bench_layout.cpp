@@ -0,0 +1,108 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// array of structs (vector_storage) against struct of arrays (soa_storage):
+// many stacks are filled round robin, so that neighbouring nodes belong to
+// different stacks, then they are walked, churned, compacted, walked again
+// and freed. frag is the fragmentation before compacting.
+
+template <std::size_t B>
+struct blob {
+  char bytes[B];
+  blob() : bytes{} {}
+  blob(const int x) : bytes{} { bytes[0] = char(x); }
+  friend bool operator<(const blob& a, const blob& b) {
+    return a.bytes[0] < b.bytes[0];
+  }
+};
+
+constexpr std::size_t n_stacks = 1024;
+constexpr std::size_t n_nodes = std::size_t(1) << 21;
+volatile std::size_t sink;  // keeps the walks alive
+
+template <typename P>
+void bench(const std::string& name) {
+  using N = typename std::decay<decltype(P{}.new_stack())>::type;
+  P pool{n_nodes};
+  std::vector<N> heads(n_stacks, pool.new_stack());
+  for (std::size_t i = 0; i < n_nodes; ++i)
+    heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+
+  timer<> t;
+  double ns[6];
+
+  // follow next() only
+  t.start();
+  std::size_t length = 0;
+  for (auto h : heads)
+    for (auto x = h; !pool.empty(x); x = pool.next(x))
+      ++length;
+  ns[0] = t.stop() * 1e9 / length;
+  sink = length;
+
+  // look at the values as well
+  t.start();
+  std::size_t found = 0;
+  for (auto h : heads)
+    found += !(*std::max_element(pool.begin(h), pool.end(h)) < 0);
+  ns[1] = t.stop() * 1e9 / n_nodes;
+  sink = found;
+
+  // pop and push back the top of every stack
+  t.start();
+  for (std::size_t r = 0; r < 64; ++r)
+    for (auto& h : heads)
+      h = pool.push(int(r), pool.pop(h));
+  ns[2] = t.stop() * 1e9 / (2 * 64 * n_stacks);
+
+  const auto frag = pool.fragmentation(heads.begin(), heads.end());
+  t.start();
+  heads = pool.compact(heads.begin(), heads.end());
+  ns[3] = t.stop() * 1e9 / n_nodes;
+
+  t.start();
+  length = 0;
+  for (auto h : heads)
+    for (auto x = h; !pool.empty(x); x = pool.next(x))
+      ++length;
+  ns[4] = t.stop() * 1e9 / length;
+  sink = length;
+
+  t.start();
+  for (auto& h : heads)
+    h = pool.free_stack(h);
+  ns[5] = t.stop() * 1e9 / n_nodes;
+
+  std::cout << std::setw(24) << name << std::setw(8) << frag;
+  for (auto x : ns)
+    std::cout << std::setw(14) << x;
+  std::cout << std::endl;
+}
+
+template <typename T, typename N>
+void bench_both(const std::string& name) {
+  bench<stack_pool<T, N, vector_storage>>("aos " + name);
+  bench<stack_pool<T, N, soa_storage>>("soa " + name);
+}
+
+int main() {
+  std::cout << n_stacks << " stacks, " << n_nodes << " nodes, ns per node"
+            << std::endl;
+  std::cout << std::setw(24) << "layout T/N" << std::setw(8) << "frag"
+            << std::setw(14) << "walk next" << std::setw(14) << "max_element"
+            << std::setw(14) << "pop+push" << std::setw(14) << "compact"
+            << std::setw(14) << "walk again" << std::setw(14) << "free_stack"
+            << std::endl;
+  bench_both<int, std::uint32_t>("int/uint32");
+  bench_both<int, std::size_t>("int/size_t");
+  bench_both<double, std::uint32_t>("double/uint32");
+  bench_both<blob<64>, std::uint32_t>("blob<64>/uint32");
+  bench_both<blob<64>, std::size_t>("blob<64>/size_t");
+}
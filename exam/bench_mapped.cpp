@@ -0,0 +1,84 @@
+#include "stack_pool.hpp"
+#include "mapped_storage.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// restarting with the stacks in a file: attaching to it against pushing every
+// value again in memory. The walk after attaching reads the pages the first
+// time, from the page cache (or the disk, if the file is cold).
+
+using N = std::uint32_t;
+using mapped_pool = stack_pool<int, N, mapped_storage>;
+using storage = mapped_storage::type<int, N>;
+constexpr std::size_t n_stacks = storage::n_roots;
+volatile long sink;
+
+template <typename P>
+void fill(P& pool, std::vector<N>& heads, const std::size_t n) {
+  heads.assign(n_stacks, pool.new_stack());
+  for (std::size_t i = 0; i < n; ++i)
+    heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+}
+
+template <typename P>
+long walk(const P& pool, const std::vector<N>& heads) {
+  long s = 0;
+  for (auto h : heads)
+    for (auto x = h; !pool.empty(x); x = pool.next(x))
+      s += pool.value(x);
+  return s;
+}
+
+int main(int argc, char* argv[]) {
+  const std::size_t n = argc > 1 ? std::stoul(argv[1]) : std::size_t(1) << 26;
+  const std::string path = argc > 2 ? argv[2] : "bench_mapped.pool";
+  std::remove(path.c_str());
+  timer<> t;
+  std::vector<N> heads;
+
+  t.start();
+  {
+    mapped_pool pool{storage{path}};
+    fill(pool, heads, n);
+    for (std::size_t i = 0; i < n_stacks; ++i)
+      pool.storage().root(i) = heads[i];
+  }
+  const auto t_create = t.stop();
+
+  t.start();
+  mapped_pool pool{storage{path}};
+  for (std::size_t i = 0; i < n_stacks; ++i)
+    heads[i] = pool.storage().root(i);
+  const auto t_attach = t.stop();
+  t.start();
+  sink = walk(pool, heads);
+  const auto t_walk = t.stop();
+
+  t.start();
+  stack_pool<int, N> memory;
+  std::vector<N> memory_heads;
+  fill(memory, memory_heads, n);
+  const auto t_rebuild = t.stop();
+  t.start();
+  sink = walk(memory, memory_heads);
+  const auto t_memory_walk = t.stop();
+
+  std::cout << n << " nodes in " << n_stacks << " stacks, "
+            << (n * sizeof(int) * 2 >> 20) << " MB" << std::endl;
+  std::cout << std::setw(28) << "create the file [ms]" << std::setw(14)
+            << t_create * 1e3 << std::endl;
+  std::cout << std::setw(28) << "attach [ms]" << std::setw(14)
+            << t_attach * 1e3 << std::endl;
+  std::cout << std::setw(28) << "first walk, mapped [ms]" << std::setw(14)
+            << t_walk * 1e3 << std::endl;
+  std::cout << std::setw(28) << "rebuild in memory [ms]" << std::setw(14)
+            << t_rebuild * 1e3 << std::endl;
+  std::cout << std::setw(28) << "walk in memory [ms]" << std::setw(14)
+            << t_memory_walk * 1e3 << std::endl;
+  std::remove(path.c_str());
+}
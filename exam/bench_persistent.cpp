@@ -0,0 +1,87 @@
+#include "persistent_stack_pool.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// a search that branches its state: a depth-first visit of a tree with the
+// given fan-out, every child is its parent's stack plus one value. Copying a
+// std::vector per branch against pushing on a persistent stack; the leaves
+// read their top. peak is the most values held at once.
+
+volatile long sink;
+
+struct copies {
+  std::size_t held = 0, peak = 0;
+  long visit(const std::vector<int>& s, const unsigned depth,
+             const unsigned fan_out) {
+    if (!depth)
+      return s.back();
+    long sum = 0;
+    for (unsigned i = 0; i < fan_out; ++i) {
+      auto child = s;  // the branch copies the whole stack
+      child.push_back(int(i));
+      held += child.size();
+      peak = std::max(peak, held);
+      sum += visit(child, depth - 1, fan_out);
+      held -= child.size();
+    }
+    return sum;
+  }
+  long run(const unsigned depth, const unsigned fan_out) {
+    return visit(std::vector<int>{0}, depth, fan_out);
+  }
+};
+
+struct persistent {
+  persistent_stack_pool<int, std::uint32_t> pool;
+  std::size_t peak = 0;
+  long visit(const std::uint32_t s, const unsigned depth,
+             const unsigned fan_out) {
+    if (!depth)
+      return pool.value(s);
+    long sum = 0;
+    for (unsigned i = 0; i < fan_out; ++i) {
+      const auto child = pool.push(int(i), s);  // one node, s is shared
+      peak = std::max(peak, std::size_t(pool.counters().live));
+      sum += visit(child, depth - 1, fan_out);
+      pool.release(child);
+    }
+    return sum;
+  }
+  long run(const unsigned depth, const unsigned fan_out) {
+    const auto root = pool.push(0, pool.new_stack());
+    const auto sum = visit(root, depth, fan_out);
+    pool.release(root);
+    return sum;
+  }
+};
+
+template <typename B>
+void bench(const std::string& name, const unsigned depth,
+           const unsigned fan_out) {
+  timer<> t;
+  B b;
+  std::size_t branches = 0;
+  for (std::size_t k = fan_out, d = 0; d < depth; ++d, k *= fan_out)
+    branches += k;
+  t.start();
+  sink = b.run(depth, fan_out);
+  const auto ns = t.stop() * 1e9 / branches;
+  std::cout << std::setw(12) << name << std::setw(8) << depth << std::setw(8)
+            << fan_out << std::setw(14) << ns << std::setw(12) << b.peak
+            << std::endl;
+}
+
+int main() {
+  std::cout << std::setw(12) << "state" << std::setw(8) << "depth"
+            << std::setw(8) << "fan-out" << std::setw(14) << "ns/branch"
+            << std::setw(12) << "peak" << std::endl;
+  const unsigned shapes[][2] = {{8, 6}, {20, 2}, {4096, 1}};  // depth, fan-out
+  for (auto s : shapes) {
+    bench<copies>("copies", s[0], s[1]);
+    bench<persistent>("persistent", s[0], s[1]);
+  }
+}
@@ -0,0 +1,88 @@
+#include "queue_pool.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// many FIFO queues in steady state: every queue holds a few values, each
+// step enqueues on one queue and dequeues from another. A std::deque per
+// queue against one queue_pool for all of them; walk is a pass over every
+// queue after the churn.
+
+using N = std::uint32_t;
+volatile long sink;
+
+struct pool_queues {
+  queue_pool<int, N> pool;
+  std::vector<queue_pool<int, N>::queue_type> queues;
+  explicit pool_queues(const std::size_t q) : queues(q, pool.new_queue()) {}
+  void enqueue(const std::size_t i, const int x) {
+    queues[i] = pool.enqueue(x, queues[i]);
+  }
+  void dequeue(const std::size_t i) { queues[i] = pool.dequeue(queues[i]); }
+  long walk(const std::size_t i) const {
+    long s = 0;
+    for (auto x = pool.cbegin(queues[i]); x != pool.cend(queues[i]); ++x)
+      s += *x;
+    return s;
+  }
+};
+
+struct deques {
+  std::vector<std::deque<int>> queues;
+  explicit deques(const std::size_t q) : queues(q) {}
+  void enqueue(const std::size_t i, const int x) { queues[i].push_back(x); }
+  void dequeue(const std::size_t i) { queues[i].pop_front(); }
+  long walk(const std::size_t i) const {
+    long s = 0;
+    for (auto x : queues[i])
+      s += x;
+    return s;
+  }
+};
+
+template <typename Q>
+void bench(const std::string& name, const std::size_t n_queues,
+           const std::size_t length, const std::size_t steps) {
+  timer<> t;
+  Q q{n_queues};
+  t.start();
+  for (std::size_t i = 0; i < n_queues * length; ++i)
+    q.enqueue(i % n_queues, int(i));
+  const auto t_fill = t.stop() * 1e9 / (n_queues * length);
+
+  t.start();
+  for (std::size_t i = 0; i < steps; ++i) {
+    q.enqueue(i * 7919 % n_queues, int(i));
+    q.dequeue(i * 7919 % n_queues);
+  }
+  const auto t_churn = t.stop() * 1e9 / steps;
+
+  t.start();
+  long s = 0;
+  for (std::size_t i = 0; i < n_queues; ++i)
+    s += q.walk(i);
+  const auto t_walk = t.stop() * 1e9 / (n_queues * length);
+  sink = s;
+
+  std::cout << std::setw(12) << name << std::setw(10) << n_queues
+            << std::setw(10) << length << std::setw(12) << t_fill
+            << std::setw(12) << t_churn << std::setw(12) << t_walk
+            << std::endl;
+}
+
+int main() {
+  const std::size_t n = std::size_t(1) << 22;
+  std::cout << "ns per value, churn is an enqueue and a dequeue" << std::endl;
+  std::cout << std::setw(12) << "queues" << std::setw(10) << "count"
+            << std::setw(10) << "length" << std::setw(12) << "fill"
+            << std::setw(12) << "churn" << std::setw(12) << "walk"
+            << std::endl;
+  for (std::size_t length : {4, 64, 1024}) {
+    bench<deques>("std::deque", n / length, length, n);
+    bench<pool_queues>("queue_pool", n / length, length, n);
+  }
+}
@@ -0,0 +1,79 @@
+#include "pool_resource.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <string>
+
+// a std::pmr::map that churns: filled with n keys, then every step erases a
+// random key and inserts another one, so that the nodes are freed and taken
+// again all the time. The same map on the heap (new_delete_resource), on the
+// pool resource of the standard library and on pool_memory_resource. walk is
+// a pass over the map after the churn, where the nodes ended up matters.
+
+volatile long sink;
+
+void bench(const std::string& name, std::pmr::memory_resource* r,
+           const std::size_t n, const std::size_t steps) {
+  timer<> t;
+  std::pmr::map<std::uint32_t, std::uint32_t> m{r};
+  std::uint32_t x = 12345;  // the same keys for every resource
+  const auto key = [&x, n] {
+    x = x * 1664525 + 1013904223;
+    return std::uint32_t(x % (4 * n));
+  };
+
+  t.start();
+  while (m.size() < n)
+    m.emplace(key(), x);
+  const auto t_fill = t.stop() * 1e9 / n;
+
+  t.start();
+  for (std::size_t i = 0; i < steps; ++i) {
+    auto k = m.lower_bound(key());
+    m.erase(k == m.end() ? m.begin() : k);
+    while (!m.emplace(key(), x).second) {
+    }
+  }
+  const auto t_churn = t.stop() * 1e9 / steps;
+
+  t.start();
+  long s = 0;
+  for (const auto& kv : m)
+    s += kv.second;
+  const auto t_walk = t.stop() * 1e9 / m.size();
+  sink = s;
+
+  t.start();
+  m.clear();
+  const auto t_clear = t.stop() * 1e9 / n;
+
+  std::cout << std::setw(20) << name << std::setw(12) << t_fill
+            << std::setw(12) << t_churn << std::setw(12) << t_walk
+            << std::setw(12) << t_clear << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  const std::size_t n = argc > 1 ? std::stoul(argv[1]) : std::size_t(1) << 20;
+  const std::size_t steps = 4 * n;
+  std::cout << "std::pmr::map of " << n << " keys, " << steps
+            << " erase+insert, ns per node" << std::endl;
+  std::cout << std::setw(20) << "resource" << std::setw(12) << "fill"
+            << std::setw(12) << "churn" << std::setw(12) << "walk"
+            << std::setw(12) << "clear" << std::endl;
+  bench("new/delete", std::pmr::new_delete_resource(), n, steps);
+  {
+    std::pmr::unsynchronized_pool_resource r;
+    bench("std unsynchronized", &r, n, steps);
+  }
+  {
+    pool_memory_resource<> r;
+    bench("pool, lifo", &r, n, steps);
+  }
+  {
+    pool_memory_resource<std::uint32_t, bitmap_free_slots> r;
+    bench("pool, bitmap", &r, n, steps);
+  }
+}
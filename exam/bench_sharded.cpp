@@ -0,0 +1,127 @@
+#include "concurrent_stack_pool.hpp"
+#include "sharded_stack_pool.hpp"
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// producers and consumers in a ring: every round each thread pushes a stack,
+// hands it to the next thread and frees, reading it, the stack it got from
+// the previous one. So every node is freed by a thread that did not push it.
+
+constexpr std::size_t depth = 64;
+constexpr std::size_t rounds = 1000;
+volatile long sink;
+
+struct locked_pool {
+  stack_pool<int> pool;
+  std::mutex m;
+  struct handle {
+    locked_pool* p;
+    std::size_t push(int v, std::size_t h) {
+      std::lock_guard<std::mutex> lock{p->m};
+      return p->pool.push(v, h);
+    }
+    long free_stack(std::size_t h) {  // the values are read under the lock too
+      std::lock_guard<std::mutex> lock{p->m};
+      long sum = 0;
+      for (; h; h = p->pool.pop(h))
+        sum += p->pool.value(h);
+      return sum;
+    }
+  };
+  explicit locked_pool(unsigned) {}
+  handle local(unsigned) { return handle{this}; }
+};
+
+struct lock_free_pool {
+  concurrent_stack_pool<int> pool;
+  struct handle {
+    concurrent_stack_pool<int>* p;
+    std::size_t push(int v, std::size_t h) { return p->push(v, h); }
+    long free_stack(std::size_t h) {
+      long sum = 0;
+      for (; h; h = p->pop(h))
+        sum += p->value(h);
+      return sum;
+    }
+  };
+  explicit lock_free_pool(unsigned) {}
+  handle local(unsigned) { return handle{&pool}; }
+};
+
+struct sharded_pool {
+  sharded_stack_pool<int> pool;
+  struct handle {
+    sharded_stack_pool<int>::shard_view s;
+    std::size_t push(int v, std::size_t h) { return s.push(v, h); }
+    long free_stack(std::size_t h) {
+      long sum = 0;
+      for (; !s.empty(h); h = s.pop(h))
+        sum += s.value(h);
+      return sum;
+    }
+  };
+  explicit sharded_pool(unsigned n_threads) : pool{n_threads} {}
+  handle local(unsigned t) { return handle{pool.shard(t)}; }
+};
+
+// slots[t] holds the stack handed to thread t, 0 when there is none
+template <typename P>
+void worker(P& pool, std::vector<std::atomic<std::size_t>>& slots,
+            const unsigned t) {
+  auto h = pool.local(t);
+  auto& to = slots[(t + 1) % slots.size()];
+  long sum = 0;
+  for (std::size_t r = 0; r < rounds; ++r) {
+    std::size_t l = 0;
+    for (std::size_t i = 0; i < depth; ++i)
+      l = h.push(int(i), l);
+    while (to.load(std::memory_order_acquire))
+      std::this_thread::yield();
+    to.store(l, std::memory_order_release);
+    std::size_t got;
+    while (!(got = slots[t].exchange(0, std::memory_order_acq_rel)))
+      std::this_thread::yield();
+    sum += h.free_stack(got);
+  }
+  sink = sum;
+}
+
+// returns ns per push and pop
+template <typename P>
+double run(const unsigned n_threads) {
+  P pool{n_threads};
+  std::vector<std::atomic<std::size_t>> slots(n_threads);
+  for (auto& s : slots)
+    s.store(0);
+  timer<> t;
+  t.start();
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < n_threads; ++i)
+    threads.emplace_back([&pool, &slots, i] { worker(pool, slots, i); });
+  for (auto& th : threads)
+    th.join();
+  const double ops = 2.0 * depth * rounds * n_threads;
+  return t.stop() * 1e9 / ops;
+}
+
+int main() {
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency()
+            << std::endl;
+  std::cout << std::setw(10) << "threads" << std::setw(18) << "mutex [ns/op]"
+            << std::setw(18) << "lock-free [ns/op]" << std::setw(18)
+            << "sharded [ns/op]" << std::endl;
+  for (unsigned n = 1; n <= 64; n *= 2) {
+    const auto tl = run<locked_pool>(n);
+    const auto tc = run<lock_free_pool>(n);
+    const auto ts = run<sharded_pool>(n);
+    std::cout << std::setw(10) << n << std::setw(18) << tl << std::setw(18)
+              << tc << std::setw(18) << ts << std::endl;
+  }
+}
@@ -0,0 +1,105 @@
+#include "snapshot_stack_pool.hpp"
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// one writer keeps pushing and popping on a few stacks while readers walk
+// them from top to bottom. The readers either lock the writer out for each
+// walk or read snapshots; the writer reclaims after each round. Reported: the
+// time of a writer's push or pop and the hops of the readers per second.
+
+using N = std::uint32_t;
+constexpr std::size_t n_stacks = 16;
+constexpr std::size_t depth = 256;
+constexpr std::size_t rounds = 20000;
+
+struct locked {
+  stack_pool<int, N> pool;
+  std::mutex m;
+  std::vector<N> heads = std::vector<N>(n_stacks);
+  void write(const std::size_t r) {
+    std::lock_guard<std::mutex> lock{m};
+    auto& h = heads[r % n_stacks];
+    for (std::size_t i = 0; i < depth; ++i)
+      h = r / n_stacks % 2 ? pool.pop(h) : pool.push(int(i), h);
+  }
+  std::size_t read(const std::size_t s, long& sum) {
+    std::lock_guard<std::mutex> lock{m};
+    std::size_t hops = 0;
+    for (auto it = pool.cbegin(heads[s]); it != pool.cend(heads[s]); ++it, ++hops)
+      sum += *it;
+    return hops;
+  }
+};
+
+struct snapshots {
+  snapshot_stack_pool<int, N> pool;
+  std::vector<std::atomic<N>> heads = std::vector<std::atomic<N>>(n_stacks);
+  void write(const std::size_t r) {
+    auto& published = heads[r % n_stacks];
+    auto h = published.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < depth; ++i)
+      h = r / n_stacks % 2 ? pool.pop(h) : pool.push(int(i), h);
+    published.store(h, std::memory_order_release);
+    pool.reclaim();
+  }
+  std::size_t read(const std::size_t s, long& sum) {
+    thread_local snapshot_stack_pool<int, N>::reader r{pool};
+    const auto snap = r.pin();
+    const auto h = heads[s].load(std::memory_order_acquire);
+    std::size_t hops = 0;
+    for (auto it = snap.cbegin(h); it != snap.cend(h); ++it, ++hops)
+      sum += *it;
+    return hops;
+  }
+};
+
+volatile long sink;
+
+template <typename P>
+void bench(const std::string& name, const unsigned n_readers) {
+  P p;
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> hops{0};
+  std::atomic<unsigned> started{0};
+  std::vector<std::thread> readers;
+  for (unsigned t = 0; t < n_readers; ++t)
+    readers.emplace_back([&p, &done, &hops, &started, t] {
+      ++started;
+      long sum = 0;
+      std::size_t n = 0;
+      for (std::size_t s = t; !done.load(std::memory_order_relaxed); ++s)
+        n += p.read(s % n_stacks, sum);
+      hops += n;
+      sink = sum;
+    });
+  while (started < n_readers)
+    std::this_thread::yield();
+  timer<> t;
+  t.start();
+  for (std::size_t r = 0; r < rounds; ++r)
+    p.write(r);
+  const auto seconds = t.stop();
+  done = true;
+  for (auto& th : readers)
+    th.join();
+  std::cout << std::setw(12) << name << std::setw(10) << n_readers
+            << std::setw(16) << seconds * 1e9 / (rounds * depth)
+            << std::setw(16) << hops / seconds / 1e6 << std::endl;
+}
+
+int main() {
+  std::cout << std::setw(12) << "readers" << std::setw(10) << "threads"
+            << std::setw(16) << "writer [ns/op]" << std::setw(16)
+            << "reads [Mhop/s]" << std::endl;
+  for (unsigned n : {0u, 1u, 2u, 4u}) {
+    bench<locked>("lock", n);
+    bench<snapshots>("snapshot", n);
+  }
+}
@@ -0,0 +1,63 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// a backtracking step: try k pushes and pops on a pool of n nodes, then
+// abandon them. Taking a copy of the pool to go back to against a checkpoint
+// and a rollback; the time is per step, the work of the step included.
+
+using N = std::uint32_t;
+using pool_type = stack_pool<int, N>;
+constexpr std::size_t n_stacks = 64;
+volatile long sink;
+
+void work(pool_type& pool, std::vector<N>& heads, const std::size_t k) {
+  for (std::size_t i = 0; i < k; ++i) {
+    auto& h = heads[i * 7919 % n_stacks];
+    h = i % 3 == 2 ? pool.pop(h) : pool.push(int(i), h);
+  }
+}
+
+void bench(const std::size_t n, const std::size_t k, const std::size_t steps) {
+  pool_type pool{n};
+  std::vector<N> heads(n_stacks, pool.new_stack());
+  for (std::size_t i = 0; i < n; ++i)
+    heads[i % n_stacks] = pool.push(int(i), heads[i % n_stacks]);
+  timer<> t;
+
+  t.start();
+  for (std::size_t s = 0; s < steps; ++s) {
+    const auto saved = pool;
+    auto h = heads;
+    work(pool, h, k);
+    pool = saved;
+  }
+  const auto t_copy = t.stop() * 1e6 / steps;
+
+  t.start();
+  for (std::size_t s = 0; s < steps; ++s) {
+    const auto cp = pool.checkpoint();
+    auto h = heads;
+    work(pool, h, k);
+    pool.rollback(cp);
+  }
+  const auto t_undo = t.stop() * 1e6 / steps;
+  sink = pool.value(heads[0]);
+
+  std::cout << std::setw(12) << n << std::setw(10) << k << std::setw(14)
+            << t_copy << std::setw(14) << t_undo << std::endl;
+}
+
+int main() {
+  std::cout << "us per step" << std::endl;
+  std::cout << std::setw(12) << "nodes" << std::setw(10) << "changes"
+            << std::setw(14) << "copy" << std::setw(14) << "rollback"
+            << std::endl;
+  for (std::size_t n : {std::size_t(1) << 12, std::size_t(1) << 20})
+    for (std::size_t k : {16, 1024})
+      bench(n, k, n > 4096 ? 1000 : 10000);
+}
@@ -0,0 +1,67 @@
+#include "stack_pool.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// the maximum of every stack, on a pool whose stacks were pushed in random
+// order, so that every hop of a walk lands far from the one before: a
+// std::max_element per stack against for_each_stack, which interleaves width
+// walks and prefetches. Reported in millions of hops per second.
+
+using N = std::uint32_t;
+constexpr std::size_t n_stacks = 4096;
+volatile long sink;
+
+void row(const std::string& name, const std::size_t n, const double seconds,
+         const double base) {
+  std::cout << std::setw(16) << name << std::setw(14) << n / seconds / 1e6
+            << std::setw(10) << base / seconds << std::endl;
+}
+
+void bench(const std::size_t n) {
+  stack_pool<int, N> pool{n};
+  std::vector<N> heads(n_stacks, pool.new_stack());
+  std::mt19937 rng{42};
+  for (std::size_t i = 0; i < n; ++i) {
+    auto& h = heads[rng() % n_stacks];
+    h = pool.push(int(rng() % 1000000), h);
+  }
+  std::cout << n << " nodes in " << n_stacks << " stacks" << std::endl;
+  std::cout << std::setw(16) << "walk" << std::setw(14) << "Mhop/s"
+            << std::setw(10) << "speedup" << std::endl;
+  timer<> t;
+  std::vector<int> maxima(n_stacks);
+
+  t.start();
+  for (std::size_t k = 0; k < n_stacks; ++k)
+    maxima[k] = *std::max_element(pool.begin(heads[k]), pool.end(heads[k]));
+  const auto base = t.stop();
+  sink = maxima[0];
+  row("max_element", n, base, base);
+
+  for (std::size_t width : {1, 4, 8, 16, 32, 64}) {
+    std::fill(maxima.begin(), maxima.end(), -1);
+    t.start();
+    pool.for_each_stack(heads.begin(), heads.end(),
+                        [&maxima](const std::size_t k, const int v) {
+                          maxima[k] = std::max(maxima[k], v);
+                        },
+                        width);
+    const auto s = t.stop();
+    sink = maxima[0];
+    row("width " + std::to_string(width), n, s, base);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1)
+    bench(std::stoul(argv[1]));
+  else
+    for (std::size_t n : {std::size_t(1) << 16, std::size_t(1) << 24})
+      bench(n);
+}
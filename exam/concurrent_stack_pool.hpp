@@ -0,0 +1,335 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "stack_pool.hpp"
+
+// A stack_pool whose free list can be shared by many threads without a lock.
+// Different stacks may be pushed/popped concurrently, a single stack must
+// still be owned by one thread at a time (exactly as a std::vector element).
+//
+// Nodes live in segments that are never moved nor freed before the pool dies:
+// segment k holds first_segment<<k nodes, so growth only appends a segment and
+// every reference returned by node()/value() stays valid.
+template <typename T, typename N = std::size_t>
+class concurrent_stack_pool{
+
+  struct node_t{
+    T value;
+    std::atomic<N> next;
+    node_t(): value{}, next{N(0)} {}
+  };
+
+  using stack_type = N;
+  using value_type = T;
+  using size_type = std::size_t;
+  using tagged_type = std::uint64_t;
+
+  static_assert(sizeof(N) <= sizeof(tagged_type), "N does not fit the tagged head");
+
+  // the free list head is (index,tag) packed in one word, the tag is bumped by
+  // every successful CAS so that a stale head never compares equal (ABA). The
+  // tag gets the bits the index leaves: 56 for an 8-bit N, 48 for 16 bits, 32
+  // for 32 bits, and only 16 for a 64-bit N, whose indices are cut to 48 bits.
+  // A 16-bit tag wraps after 65536 CASes on the head: a thread stalled that
+  // long between reading the head and its CAS may succeed on a stale one.
+  // Prefer a 32-bit N where that matters, its tag wraps after 2^32.
+  static constexpr unsigned index_bits = sizeof(N) >= 8 ? 48 : 8*sizeof(N);
+  static constexpr unsigned tag_bits = 8*sizeof(tagged_type) - index_bits;
+  static_assert(tag_bits >= 16, "the ABA tag needs at least 16 bits");
+  static constexpr tagged_type index_mask = (tagged_type(1) << index_bits) - 1;
+
+  static constexpr unsigned first_segment_bits = 3; // start at 8 nodes, as stack_pool
+  using segment = doubling_segments<first_segment_bits>; // see pool_storage.hpp
+  static constexpr unsigned max_segments = index_bits - first_segment_bits;
+
+  std::atomic<node_t*> segments[max_segments];
+  std::atomic<tagged_type> free_nodes{tagged_type(0)};
+  std::atomic<size_type> n_segments{0};
+  std::mutex grow_mutex; // taken only when the free list runs dry
+
+  static stack_type index(const tagged_type h) noexcept { return stack_type(h & index_mask); }
+  static tagged_type tag(const tagged_type h) noexcept { return h >> index_bits; }
+  static tagged_type make_tagged(const stack_type x, const tagged_type t) noexcept {
+    return (t << index_bits) | (tagged_type(x) & index_mask);
+  }
+
+  node_t& node(const stack_type x) noexcept { return segment::at(segments, size_type(x) - 1); }
+  const node_t& node(const stack_type x) const noexcept { return segment::at(segments, size_type(x) - 1); }
+
+  void add_segment();
+  void refill();
+  void release_chain(const stack_type first, const stack_type last) noexcept;
+  stack_type acquire_node();
+  size_type acquire_chain(const size_type n, stack_type* out);
+
+  template <typename X>
+  stack_type _push(X&& val, const stack_type head);
+
+  public:
+
+  concurrent_stack_pool() noexcept {
+    for(auto& s : segments)
+      s.store(nullptr, std::memory_order_relaxed);
+  }
+  explicit concurrent_stack_pool(const size_type n): concurrent_stack_pool() { reserve(n); }
+  concurrent_stack_pool(const concurrent_stack_pool&) = delete;
+  concurrent_stack_pool& operator=(const concurrent_stack_pool&) = delete;
+  ~concurrent_stack_pool() noexcept {
+    for(auto& s : segments)
+      delete[] s.load(std::memory_order_relaxed);
+  }
+
+  stack_type new_stack() const noexcept { return end(); }
+
+  void reserve(const size_type n); // reserve n nodes in the pool
+
+  size_type capacity() const noexcept { return segment::capacity(n_segments.load(std::memory_order_acquire)); }
+
+  bool empty(const stack_type x) const noexcept { return x == end(); }
+
+  stack_type end() const noexcept { return stack_type(0); }
+
+  value_type& value(const stack_type x) noexcept { return node(x).value; }
+  const value_type& value(const stack_type x) const noexcept { return node(x).value; }
+
+  // next is atomic because a free node may be inspected by a thread that lost
+  // the race for it, so it is handed out by value
+  stack_type next(const stack_type x) const noexcept { return node(x).next.load(std::memory_order_relaxed); }
+
+  stack_type push(const value_type& val, const stack_type head) { return _push(val,head); }
+
+  stack_type push(value_type&& val, const stack_type head) { return _push(std::move(val),head); }
+
+  stack_type pop(const stack_type x) noexcept;
+
+  stack_type free_stack(stack_type x) noexcept;
+
+  stack_type free_stack(const stack_type head, const stack_type tail) noexcept { // O(1), tail is the last node of head
+    if(!empty(head))
+      release_chain(head,tail);
+    return end();
+  }
+
+  using iterator = _iterator<concurrent_stack_pool, value_type, stack_type>;
+  using const_iterator = _iterator<const concurrent_stack_pool, const value_type, stack_type>;
+
+  iterator begin(const stack_type x) { return iterator(this,x); }
+  iterator end(const stack_type ) noexcept { return iterator(this,end()); }
+
+  const_iterator begin(const stack_type x) const { return const_iterator(this,x); }
+  const_iterator end(const stack_type ) const noexcept { return const_iterator(this,end()); }
+
+  const_iterator cbegin(const stack_type x) const { return const_iterator(this,x); }
+  const_iterator cend(const stack_type ) const noexcept { return const_iterator(this,end()); }
+
+  class thread_cache;
+};
+
+
+// A per-thread magazine of free nodes in front of the shared list, in the
+// spirit of the tcmalloc/mimalloc front-ends: push and pop through a cache
+// touch only the magazine, which is refilled and flushed batch nodes at a time
+// with a single CAS. A cache must not be shared between threads and gives its
+// nodes back to the pool when it is destroyed.
+template <typename T, typename N>
+class concurrent_stack_pool<T,N>::thread_cache{
+  concurrent_stack_pool* pool;
+  std::vector<stack_type> magazine;
+  size_type batch;
+
+  template <typename X>
+  stack_type _push(X&& val, const stack_type head);
+
+  public:
+
+  struct statistics{
+    size_type allocations{0}; // nodes handed out by the cache
+    size_type deallocations{0}; // nodes given back to the cache
+    size_type refills{0}; // slow path: batches taken from the shared list
+    size_type flushes{0}; // slow path: batches given back to the shared list
+  };
+
+  explicit thread_cache(concurrent_stack_pool& p, const size_type b = 32):
+    pool{&p}, batch{b ? b : 1} { magazine.reserve(2*batch); }
+  thread_cache(const thread_cache&) = delete;
+  thread_cache& operator=(const thread_cache&) = delete;
+  ~thread_cache() noexcept { flush(magazine.size()); }
+
+  stack_type push(const value_type& val, const stack_type head) { return _push(val,head); }
+
+  stack_type push(value_type&& val, const stack_type head) { return _push(std::move(val),head); }
+
+  stack_type pop(const stack_type x);
+
+  stack_type free_stack(stack_type x) { return pool->free_stack(x); }
+
+  void flush(size_type n) noexcept; // give back the n least recently freed nodes
+
+  size_type size() const noexcept { return magazine.size(); }
+
+  const statistics& stats() const noexcept { return counters; }
+
+  private:
+  statistics counters;
+};
+
+
+template <typename T, typename N>
+void concurrent_stack_pool<T,N>::add_segment() {
+  const auto k = n_segments.load(std::memory_order_relaxed);
+  const auto first = segment::capacity(k) + 1;
+  const auto last = segment::capacity(k+1);
+  if(k == max_segments || last > size_type(std::numeric_limits<N>::max()))
+    throw std::length_error{"concurrent_stack_pool: address space of N exhausted"};
+
+  auto seg = new node_t[segment::size(k)];
+  for(size_type i = 0; i + 1 < segment::size(k); ++i)
+    seg[i].next.store(stack_type(first + i + 1), std::memory_order_relaxed);
+  segments[k].store(seg, std::memory_order_release);
+  n_segments.store(k+1, std::memory_order_release);
+  release_chain(stack_type(first), stack_type(last));
+}
+
+template <typename T, typename N>
+void concurrent_stack_pool<T,N>::reserve(const size_type n) {
+  std::lock_guard<std::mutex> lock{grow_mutex};
+  while(capacity() < n)
+    add_segment();
+}
+
+// splice first -> ... -> last on top of the free list
+template <typename T, typename N>
+void concurrent_stack_pool<T,N>::release_chain(const stack_type first, const stack_type last) noexcept {
+  auto& tail = node(last).next;
+  auto old = free_nodes.load(std::memory_order_relaxed);
+  do
+    tail.store(index(old), std::memory_order_relaxed);
+  while(!free_nodes.compare_exchange_weak(old, make_tagged(first, tag(old)+1),
+                                          std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <typename T, typename N>
+void concurrent_stack_pool<T,N>::refill() {
+  std::lock_guard<std::mutex> lock{grow_mutex};
+  if(empty(index(free_nodes.load(std::memory_order_acquire)))) // nobody refilled the list while we were waiting
+    add_segment();
+}
+
+template <typename T, typename N>
+N concurrent_stack_pool<T,N>::acquire_node() {
+  auto old = free_nodes.load(std::memory_order_acquire);
+  for(;;){
+    const auto x = index(old);
+    if(empty(x)){
+      refill();
+      old = free_nodes.load(std::memory_order_acquire);
+      continue;
+    }
+    // x may be stolen under our feet: reading its next is harmless because
+    // segments are never freed, and the tag makes the CAS fail
+    const auto nx = node(x).next.load(std::memory_order_relaxed);
+    if(free_nodes.compare_exchange_weak(old, make_tagged(nx, tag(old)+1),
+                                        std::memory_order_acquire, std::memory_order_acquire))
+      return x;
+  }
+}
+
+// detach up to n nodes from the free list with a single CAS, store them in out
+// and return how many they are
+template <typename T, typename N>
+typename concurrent_stack_pool<T,N>::size_type concurrent_stack_pool<T,N>::acquire_chain(const size_type n, stack_type* out) {
+  auto old = free_nodes.load(std::memory_order_acquire);
+  for(;;){
+    auto x = index(old);
+    if(empty(x)){
+      refill();
+      old = free_nodes.load(std::memory_order_acquire);
+      continue;
+    }
+    size_type k = 0;
+    // the walk may race with other threads, in which case the tag has changed
+    // and the CAS below throws away whatever we have read
+    for(; k < n && !empty(x); ++k){
+      out[k] = x;
+      x = node(x).next.load(std::memory_order_relaxed);
+    }
+    if(free_nodes.compare_exchange_weak(old, make_tagged(x, tag(old)+1),
+                                        std::memory_order_acquire, std::memory_order_acquire))
+      return k;
+  }
+}
+
+template <typename T, typename N>
+template <typename X>
+N concurrent_stack_pool<T,N>::_push(X&& val, const stack_type head) {
+  const auto tmp = acquire_node();
+  auto& n = node(tmp);
+  n.value = std::forward<X>(val);
+  n.next.store(head, std::memory_order_relaxed);
+  return tmp;
+}
+
+template <typename T, typename N>
+N concurrent_stack_pool<T,N>::pop(const stack_type x) noexcept {
+  const auto tmp = next(x);
+  release_chain(x,x);
+  return tmp;
+}
+
+template <typename T, typename N>
+N concurrent_stack_pool<T,N>::free_stack(stack_type x) noexcept {
+  if(empty(x))
+    return x;
+  // the stack is private to the caller: find its tail and give it back at once
+  auto last = x;
+  for(auto n = next(last); !empty(n); n = next(last))
+    last = n;
+  return free_stack(x,last);
+}
+
+
+template <typename T, typename N>
+template <typename X>
+N concurrent_stack_pool<T,N>::thread_cache::_push(X&& val, const stack_type head) {
+  if(magazine.empty()){
+    magazine.resize(batch);
+    magazine.resize(pool->acquire_chain(batch, magazine.data()));
+    ++counters.refills;
+  }
+  const auto tmp = magazine.back();
+  magazine.pop_back();
+  ++counters.allocations;
+  auto& n = pool->node(tmp);
+  n.value = std::forward<X>(val);
+  n.next.store(head, std::memory_order_relaxed);
+  return tmp;
+}
+
+template <typename T, typename N>
+N concurrent_stack_pool<T,N>::thread_cache::pop(const stack_type x) {
+  const auto tmp = pool->next(x);
+  if(magazine.size() == 2*batch)
+    flush(batch);
+  magazine.push_back(x);
+  ++counters.deallocations;
+  return tmp;
+}
+
+template <typename T, typename N>
+void concurrent_stack_pool<T,N>::thread_cache::flush(size_type n) noexcept {
+  n = std::min(n, magazine.size());
+  if(!n)
+    return;
+  // the oldest nodes go back, the hot ones stay in the magazine
+  for(size_type i = 0; i + 1 < n; ++i)
+    pool->node(magazine[i]).next.store(magazine[i+1], std::memory_order_relaxed);
+  pool->release_chain(magazine[0], magazine[n-1]);
+  magazine.erase(magazine.begin(), magazine.begin() + n);
+  ++counters.flushes;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "stack_pool.hpp"
+
+// A stack_pool whose handles carry a generation next to the address, so that a
+// stale handle, one whose node has been popped (and maybe pushed again on
+// another stack), is caught instead of silently reading someone else's data.
+// Every node has a generation, bumped whenever the node is freed; a handle is
+// valid while its generation matches the one of its node, and checking it is a
+// single compare, after the address is bounded by the nodes handed out so far.
+// Invalid handles make the accessors throw std::invalid_argument, also those to
+// nodes reserved but never handed out and those from another pool.
+//
+// The handles are twice as wide as N: the address in the low half, the
+// generation in the high half. A generation wraps after 2^(8*sizeof(N)) frees
+// of the same node, a handle that stale is not caught. end() is 0 as usual, the
+// links stored in the pool are plain addresses, so the nodes cost no more.
+//
+// The checks are opt-in: maybe_guarded_stack_pool<false, ...> is stack_pool
+// itself, with not a single instruction more.
+
+namespace guarded_detail{
+  template <typename N> struct wider;
+  template <> struct wider<std::uint8_t>{ using type = std::uint16_t; };
+  template <> struct wider<std::uint16_t>{ using type = std::uint32_t; };
+  template <> struct wider<std::uint32_t>{ using type = std::uint64_t; };
+}
+
+template <typename T, typename N = std::uint32_t, typename S = vector_storage, typename G = typename S::growth,
+          typename R = lifo_free_list>
+class guarded_stack_pool{
+  using pool_type = stack_pool<T,N,S,G,R>;
+  using stack_type = typename guarded_detail::wider<N>::type; // a handle
+  using value_type = T;
+  using size_type = typename S::template type<T,N>::size_type;
+  static constexpr unsigned bits = 8 * sizeof(N);
+
+  pool_type pool;
+  // the generation of the node at address i, end included: it stays 0, so that
+  // the end handle needs no special case. As long as the capacity, but only the
+  // nodes up to the high-water mark of the storage have been handed out
+  std::vector<N> generations = std::vector<N>(1);
+
+  static N address(const stack_type x) noexcept { return N(x); }
+  static N generation(const stack_type x) noexcept { return N(x >> bits); }
+
+  stack_type handle(const N x) const noexcept { return stack_type(generations[x]) << bits | x; } // a link, always valid
+
+  N check(const stack_type x) const { // the address may be anything, e.g. from another pool
+    if(!valid(x))
+      throw std::invalid_argument{"guarded_stack_pool: stale handle"};
+    return address(x);
+  }
+
+  stack_type pushed(const N x) { // the nodes past the old high-water mark are new, not only x
+    if(pool.storage().size() >= generations.size())
+      generations.resize(pool.capacity() + 1);
+    return handle(x);
+  }
+
+  void retire(N x, size_type n) noexcept { // the first n nodes of x are going to be freed
+    for(; n && x; --n, x = pool.next(x))
+      ++generations[x];
+  }
+
+  public:
+  guarded_stack_pool() = default;
+  explicit guarded_stack_pool(const size_type n): pool{n} {}
+  guarded_stack_pool(const guarded_stack_pool&) = default;
+  guarded_stack_pool& operator=(const guarded_stack_pool&) = default;
+  guarded_stack_pool(guarded_stack_pool&& x): pool{std::move(x.pool)} { generations.swap(x.generations); }
+  guarded_stack_pool& operator=(guarded_stack_pool&& x) noexcept { // x is left empty, like a stack_pool
+    pool = std::move(x.pool);
+    generations.swap(x.generations);
+    x.generations.assign(1, N(0)); // cannot throw, the capacity is there
+    return *this;
+  }
+
+  stack_type new_stack() const noexcept { return end(); }
+
+  void reserve(const size_type n) { pool.reserve(n); }
+  static constexpr size_type max_size() noexcept { return pool_type::max_size(); }
+  size_type capacity() const noexcept { return pool.capacity(); }
+
+  bool empty(const stack_type x) const noexcept { return !address(x); }
+  stack_type end() const noexcept { return stack_type(0); }
+
+  // false if x is stale
+  bool valid(const stack_type x) const noexcept {
+    return address(x) <= pool.storage().size() && generation(x) == generations[address(x)];
+  }
+
+  value_type& value(const stack_type x) { return pool.value(check(x)); }
+  const value_type& value(const stack_type x) const { return pool.value(check(x)); }
+
+  stack_type next(const stack_type x) const { return handle(pool.next(check(x))); }
+
+  template <typename... Args>
+  stack_type emplace(const stack_type head, Args&&... args) {
+    return pushed(pool.emplace(check(head), std::forward<Args>(args)...));
+  }
+  stack_type push(const value_type& val, const stack_type head) { return emplace(head, val); }
+  stack_type push(value_type&& val, const stack_type head) { return emplace(head, std::move(val)); }
+
+  template <typename I>
+  stack_type push_range(I first, I last, const stack_type head) {
+    return pushed(pool.push_range(first, last, check(head)));
+  }
+
+  stack_type pop(const stack_type x) {
+    const auto a = check(x);
+    ++generations[a];
+    return handle(pool.pop(a));
+  }
+
+  template <typename O>
+  stack_type pop_n(const stack_type x, const size_type n, O out) {
+    const auto a = check(x);
+    retire(a, n);
+    return handle(pool.pop_n(a, n, out));
+  }
+
+  stack_type free_stack(const stack_type x) {
+    const auto a = check(x);
+    retire(a, size_type(-1));
+    return handle(pool.free_stack(a));
+  }
+
+  const typename pool_type::statistics& counters() const noexcept { return pool.counters(); }
+
+  void clear() noexcept { // every handle becomes stale
+    for(auto g = generations.begin() + 1; g != generations.end(); ++g)
+      ++*g;
+    pool.clear();
+  }
+
+  using iterator = _iterator<guarded_stack_pool, value_type, stack_type>;
+  using const_iterator = _iterator<const guarded_stack_pool, const value_type, stack_type>;
+
+  // the head is checked here, the links followed by the iterators are always valid
+  iterator begin(const stack_type x) { check(x); return iterator(this,x); }
+  iterator end(const stack_type ) noexcept { return iterator(this,end()); }
+
+  const_iterator begin(const stack_type x) const { check(x); return const_iterator(this,x); }
+  const_iterator end(const stack_type ) const noexcept { return const_iterator(this,end()); }
+
+  const_iterator cbegin(const stack_type x) const { return begin(x); }
+  const_iterator cend(const stack_type x) const noexcept { return end(x); }
+};
+
+template <bool Guarded, typename T, typename N = std::uint32_t, typename S = vector_storage,
+          typename G = typename S::growth, typename R = lifo_free_list>
+using maybe_guarded_stack_pool = typename std::conditional<Guarded, guarded_stack_pool<T,N,S,G,R>, stack_pool<T,N,S,G,R>>::type;
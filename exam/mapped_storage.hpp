@@ -0,0 +1,242 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pool_growth.hpp"
+#include "pool_storage.hpp"
+
+// A storage policy (see pool_storage.hpp) that keeps the nodes in a
+// memory-mapped file. Addresses are indices, not pointers, so the file can be
+// mapped anywhere: reopening it attaches to every stack with a single mmap,
+// whatever its size, and the pages are read lazily while the stacks are used.
+// Only the free nodes are read when it is opened, to check their links: a
+// corrupted file is refused before a push can follow one past the nodes.
+//
+//   using pool_type = stack_pool<int, std::uint32_t, mapped_storage>;
+//   pool_type pool{mapped_storage::type<int, std::uint32_t>{"stacks.pool"}};
+//   pool.storage().root(0) = pool.push(42, pool.storage().root(0));
+//
+// The file starts with a header holding the layout, the high-water mark, the
+// count of live nodes, the head of the free nodes and a few roots where the
+// heads of the stacks can be kept, then the nodes follow. Growth extends the file and the mapping. Only
+// trivially copyable values can live there: they are never constructed nor
+// destroyed when the file is opened or closed. A default constructed storage
+// uses anonymous memory, and forgets everything when it is destroyed.
+// The file is locked: a second storage on the same file cannot be opened.
+
+struct mapped_storage{
+  using growth = geometric_growth<2, 1, 1024>;
+  template <typename T, typename N>
+  class type{
+    static_assert(std::is_trivially_copyable<T>::value, "the values must be trivially copyable to live in a file");
+
+    struct node_t{
+      raw_value<T> value;
+      N next;
+    };
+
+    public:
+    using size_type = std::size_t;
+    static constexpr size_type n_roots = 16;
+
+    private:
+    static constexpr std::uint64_t magic = 0x6c6f6f706b617473; // "stakpool"
+
+    struct header{
+      std::uint64_t magic;
+      std::uint32_t value_size, value_align, link_size, node_size;
+      std::uint64_t size; // the high-water mark
+      std::uint64_t live; // the nodes in some stack, counted by stack_pool
+      N free;
+      N roots[n_roots];
+    };
+
+    static constexpr size_type page = 64; // nodes start on a cache line
+    static constexpr size_type header_bytes = (sizeof(header) + page - 1) / page * page;
+    static_assert(alignof(node_t) <= page, "over-aligned values are not supported");
+
+    header none{magic, sizeof(T), alignof(T), sizeof(N), sizeof(node_t), 0, 0, N(0), {}}; // used until something is mapped
+    header* h{&none};
+    char* base{nullptr};
+    size_type bytes{0}; // mapped
+    int fd{-1};
+
+    node_t& node(const size_type i) noexcept { return reinterpret_cast<node_t*>(base + header_bytes)[i]; }
+    const node_t& node(const size_type i) const noexcept { return reinterpret_cast<const node_t*>(base + header_bytes)[i]; }
+
+    [[noreturn]] static void fail(const std::string& what) {
+      throw std::system_error{errno, std::generic_category(), "mapped_storage: " + what};
+    }
+
+    // map n bytes, keeping what is already there: the file is extended (or
+    // cut) to n bytes, the mapping may move
+    void map(const size_type n) {
+      if(fd >= 0 && n > bytes && ::ftruncate(fd, off_t(n)) != 0)
+        fail("cannot extend the file");
+      void* p;
+      if(!base)
+        p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, fd, 0);
+      else{
+#ifdef MREMAP_MAYMOVE
+        p = ::mremap(base, bytes, n, MREMAP_MAYMOVE); // the kernel moves the page tables, not the bytes
+#else
+        p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, fd, 0);
+        if(p != MAP_FAILED){
+          if(fd < 0)
+            std::memcpy(p, base, std::min(n, bytes));
+          ::munmap(base, bytes);
+        }
+#endif
+      }
+      if(p == MAP_FAILED)
+        fail("cannot map " + std::to_string(n) + " bytes");
+      if(fd >= 0 && n < bytes && ::ftruncate(fd, off_t(n)) != 0)
+        fail("cannot shrink the file");
+      if(!base) // the header moves into the mapping
+        std::memcpy(p, h, sizeof(header));
+      base = static_cast<char*>(p);
+      bytes = n;
+      h = reinterpret_cast<header*>(base);
+    }
+
+    // map a file written by a previous storage, after checking it holds nodes like ours
+    void attach(const size_type n) {
+      if(n < header_bytes)
+        throw std::runtime_error{"mapped_storage: not a stack_pool file"};
+      void* p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(p == MAP_FAILED)
+        fail("cannot map the file");
+      base = static_cast<char*>(p);
+      bytes = n;
+      const auto& x = *reinterpret_cast<const header*>(base);
+      if(x.magic != none.magic || x.value_size != none.value_size || x.value_align != none.value_align
+         || x.link_size != none.link_size || x.node_size != none.node_size)
+        throw std::runtime_error{"mapped_storage: the file holds a different kind of pool"};
+      if(x.size > capacity())
+        throw std::runtime_error{"mapped_storage: the file is truncated"};
+      // the user follows the roots, a push the free nodes: nothing past the nodes,
+      // and the free nodes end within size links, or they go round in a cycle
+      auto corrupted = x.live > x.size || std::any_of(x.roots, x.roots + n_roots, [&x](const N r){ return r > x.size; });
+      size_type n_free = 0;
+      for(auto f = x.free; f && !corrupted; f = node(f-1).next)
+        corrupted = f > x.size || ++n_free > x.size;
+      if(corrupted)
+        throw std::runtime_error{"mapped_storage: the file is corrupted"};
+      h = reinterpret_cast<header*>(base);
+    }
+
+    void release() noexcept {
+      if(base)
+        ::munmap(base, bytes);
+      if(fd >= 0)
+        ::close(fd);
+      base = nullptr;
+      bytes = 0;
+      fd = -1;
+      h = &none;
+    }
+
+    public:
+    type() noexcept = default;
+
+    // open the pool stored in path, or start a new one if the file is empty or missing
+    explicit type(const std::string& path) {
+      try {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0)
+          fail("cannot open " + path);
+        if(::flock(fd, LOCK_EX | LOCK_NB) != 0)
+          fail(path + " is already in use");
+        struct stat st;
+        if(::fstat(fd, &st) != 0)
+          fail("cannot stat " + path);
+        if(st.st_size == 0)
+          map(header_bytes);
+        else
+          attach(size_type(st.st_size));
+      } catch(...) {
+        release();
+        throw;
+      }
+    }
+
+    type(const type&) = delete; // a file has a single owner
+    type(type&& s) noexcept { swap(s); }
+    type& operator=(type s) noexcept { swap(s); return *this; }
+    ~type() noexcept { release(); } // the nodes stay in the file
+
+    void swap(type& s) noexcept {
+      std::swap(none, s.none);
+      std::swap(h, s.h);
+      std::swap(base, s.base);
+      std::swap(bytes, s.bytes);
+      std::swap(fd, s.fd);
+      if(h == &s.none)
+        h = &none;
+      if(s.h == &none)
+        s.h = &s.none;
+    }
+
+    T& value(const size_type i) noexcept { return node(i).value.get(); }
+    const T& value(const size_type i) const noexcept { return node(i).value.get(); }
+
+    N& next(const size_type i) noexcept { return node(i).next; }
+    const N& next(const size_type i) const noexcept { return node(i).next; }
+
+    N& free_head() noexcept { return h->free; }
+    const N& free_head() const noexcept { return h->free; }
+
+    // slots in the header for the heads of the stacks, they survive with the file
+    N& root(const size_type i) noexcept { return h->roots[i]; }
+    const N& root(const size_type i) const noexcept { return h->roots[i]; }
+
+    // the pool keeps its count of live nodes here, so that reopening the file does not count them
+    std::uint64_t& live() noexcept { return h->live; }
+    const std::uint64_t& live() const noexcept { return h->live; }
+
+    size_type size() const noexcept { return h->size; }
+    size_type capacity() const noexcept { return bytes ? (bytes - header_bytes) / sizeof(node_t) : 0; }
+
+    template <typename F>
+    size_type reserve(const size_type n, F&&) { // the kernel moves the pages, not the bytes
+      if(n > capacity())
+        map(header_bytes + n * sizeof(node_t));
+      return 0;
+    }
+    void emplace_back(const N x) {
+      if(size() == capacity())
+        reserve(size() + 1, nullptr);
+      node(size()).next = x;
+      ++h->size;
+    }
+    void clear() noexcept {
+      h->size = 0;
+      h->live = 0;
+      h->free = N(0);
+      std::fill(h->roots, h->roots + n_roots, N(0));
+    }
+
+    template <typename F>
+    void shrink_to_fit(const size_type n, F&&) {
+      h->size = n;
+      if(bytes)
+        map(header_bytes + n * sizeof(node_t));
+    }
+
+    // wait until the file on disk holds what is in memory
+    void sync() {
+      if(fd >= 0 && ::msync(base, bytes, MS_SYNC) != 0)
+        fail("cannot sync the file");
+    }
+  };
+};
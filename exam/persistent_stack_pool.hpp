@@ -0,0 +1,105 @@
+#pragma once
+#include <utility>
+#include "stack_pool.hpp"
+
+// Persistent stacks: pushing on a stack does not change it, the new node just
+// points to the old head, so any number of stacks can share a tail and
+// branching a stack costs one node, not a copy. The values are immutable.
+//
+// Each node counts its references: the handles the user owns and the nodes
+// that have it as next. push takes a new reference to the head it is pushed
+// on and returns a handle that owns one to the new node, share() makes one
+// more, release() drops one and frees the nodes that nobody references any
+// more. A handle must be released exactly once, like a pointer from new; the
+// pool holds as many nodes as the distinct values, whatever the branches.
+// The counters are N wide: a node cannot have more than max_size() owners.
+template <typename T, typename N = std::size_t, typename S = vector_storage, typename G = typename S::growth,
+          typename R = lifo_free_list>
+class persistent_stack_pool{
+  struct node_t{ // the value of a node of the stack_pool
+    T value;
+    N refs;
+    template <typename... Args>
+    explicit node_t(Args&&... args): value(std::forward<Args>(args)...), refs{1} {}
+  };
+
+  using pool_type = stack_pool<node_t,N,S,G,R>;
+  pool_type pool;
+  using stack_type = N;
+  using value_type = T;
+  using size_type = typename S::template type<node_t,N>::size_type;
+
+  public:
+  persistent_stack_pool() noexcept = default;
+  explicit persistent_stack_pool(const size_type n): pool{n} {} // reserve n nodes in the pool
+
+  stack_type new_stack() const noexcept { return end(); } // return an empty stack
+
+  void reserve(const size_type n) { pool.reserve(n); }
+  static constexpr size_type max_size() noexcept { return pool_type::max_size(); }
+  size_type capacity() const noexcept { return pool.capacity(); }
+
+  bool empty(const stack_type x) const noexcept { return x == end(); }
+  stack_type end() const noexcept { return stack_type(0); }
+
+  const value_type& value(const stack_type x) const noexcept { return pool.value(x).value; }
+  stack_type next(const stack_type x) const noexcept { return pool.next(x); } // borrowed, not owned
+
+  N use_count(const stack_type x) const noexcept { return empty(x) ? N(0) : pool.value(x).refs; }
+
+  // one more owner of x, e.g. a branch that keeps it; returns x
+  stack_type share(const stack_type x) noexcept {
+    if(!empty(x))
+      ++pool.value(x).refs;
+    return x;
+  }
+
+  // a new stack on top of head, which stays valid and owned by the caller
+  template <typename... Args>
+  stack_type emplace(const stack_type head, Args&&... args) {
+    const auto x = pool.emplace(head, std::forward<Args>(args)...);
+    share(head);
+    return x;
+  }
+  stack_type push(const value_type& val, const stack_type head) { return emplace(head, val); }
+  stack_type push(value_type&& val, const stack_type head) { return emplace(head, std::move(val)); }
+
+  // drop the reference owned by x: the nodes from x on that nobody else
+  // references are freed at once. Returns how many were freed.
+  size_type release(const stack_type x) noexcept;
+
+  // the stack below x, owned by the caller, in place of x
+  stack_type pop(const stack_type x) noexcept {
+    const auto n = share(next(x));
+    release(x);
+    return n;
+  }
+
+  void clear() noexcept { pool.clear(); } // every stack is gone, the capacity is kept
+
+  const typename pool_type::statistics& counters() const noexcept { return pool.counters(); }
+
+  using const_iterator = _iterator<const persistent_stack_pool, const value_type, stack_type>;
+  using iterator = const_iterator;
+
+  const_iterator begin(const stack_type x) const { return const_iterator(this,x); }
+  const_iterator end(const stack_type ) const noexcept { return const_iterator(this,end()); }
+
+  const_iterator cbegin(const stack_type x) const { return const_iterator(this,x); }
+  const_iterator cend(const stack_type ) const noexcept { return const_iterator(this,end()); }
+};
+
+
+template <typename T, typename N, typename S, typename G, typename R>
+typename persistent_stack_pool<T,N,S,G,R>::size_type persistent_stack_pool<T,N,S,G,R>::release(const stack_type x) noexcept {
+  if(empty(x) || --pool.value(x).refs)
+    return 0;
+  auto tail = x; // the nodes x..tail are unreferenced and linked already
+  size_type n = 1;
+  while(!empty(next(tail)) && !--pool.value(next(tail)).refs){
+    tail = next(tail);
+    ++n;
+  }
+  pool.free_stack(x, tail, n);
+  return n;
+}
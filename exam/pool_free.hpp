@@ -0,0 +1,197 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Free-node policies for stack_pool: how the recycled nodes are kept and which
+// one a push gets. A policy is a tag whose nested type<N> works on the storage
+// s of the pool (see pool_storage.hpp), with 0-based indices like the storage
+// and 1-based addresses like the pool:
+//
+//   empty(s)                    no node to recycle
+//   take(s, hint)               remove a free node and return its address, the
+//                               hint is the head the node is pushed on
+//   give(s, head, tail)         add the nodes of the chain head..tail, linked
+//                               by s.next()
+//   for_each(s, f)              f(i) for every free node i
+//   reserve(s, n)               make room for the nodes below n, so that give
+//                               never allocates: called before the pool hands
+//                               out a node it never used
+//   forget_from(s, n)           drop the free nodes from index n on
+//   clear(s)                    drop every free node
+//
+// Nodes past s.size() have never been used and are never free.
+
+
+// the free nodes are a stack threaded through the links, with its head in the
+// storage: take and give are O(1), even for a whole chain, and take hands out
+// the node freed last, wherever it is
+struct lifo_free_list{
+  template <typename N>
+  class type{
+    public:
+    template <typename St>
+    static bool empty(const St& s) noexcept { return !s.free_head(); }
+
+    template <typename St>
+    static N take(St& s, N) noexcept {
+      const auto x = s.free_head();
+      s.free_head() = s.next(x-1);
+      return x;
+    }
+
+    template <typename St>
+    static void give(St& s, const N head, const N tail) noexcept {
+      s.next(tail-1) = s.free_head();
+      s.free_head() = head;
+    }
+
+    template <typename St, typename F>
+    static void for_each(const St& s, F f) {
+      for(auto x = s.free_head(); x; x = s.next(x-1))
+        f(std::size_t(x-1));
+    }
+
+    template <typename St>
+    static void reserve(St&, std::size_t) noexcept {}
+
+    template <typename St>
+    static void forget_from(St& s, const std::size_t n) noexcept {
+      for(auto f = &s.free_head(); *f; ) // unlink the free nodes that are going away
+        if(std::size_t(*f) > n)
+          *f = s.next(*f-1);
+        else
+          f = &s.next(*f-1);
+    }
+
+    template <typename St>
+    static void clear(St& s) noexcept { s.free_head() = N(0); }
+  };
+};
+
+
+// one bit per node, set while the node is free, and above it a hierarchy of
+// summaries where a bit is set if the word below it is not 0: finding the
+// lowest free node costs a find-first-set per level. take prefers a free node
+// in the same 64 as the head, then the lowest one, so new stacks fill the holes
+// from the bottom of the pool and stay close together. give walks the chain.
+// The bits live in memory, not in the storage: with mapped_storage they are
+// lost when the file is closed.
+struct bitmap_free_slots{
+  template <typename N>
+  class type{
+    using word = std::uint64_t;
+    static constexpr std::size_t bits = 64;
+    std::vector<std::vector<word>> levels; // levels[0] has a bit per node, the top one a single word
+    std::size_t covered{0}; // nodes levels[0] has room for
+
+    static std::size_t lowest(const word w) noexcept {
+#if defined(__GNUC__)
+      return std::size_t(__builtin_ctzll(w));
+#else
+      std::size_t i = 0;
+      while(!(w >> i & 1))
+        ++i;
+      return i;
+#endif
+    }
+
+    void set(std::size_t i) noexcept {
+      for(auto& l : levels){
+        const auto was = l[i / bits];
+        l[i / bits] = was | word(1) << i % bits;
+        if(was)
+          break;
+        i /= bits;
+      }
+    }
+
+    void reset(std::size_t i) noexcept {
+      for(auto& l : levels){
+        l[i / bits] &= ~(word(1) << i % bits);
+        if(l[i / bits])
+          break;
+        i /= bits;
+      }
+    }
+
+    std::size_t find_first() const noexcept { // levels is not empty
+      std::size_t w = 0;
+      for(auto l = levels.rbegin(); l != levels.rend(); ++l)
+        w = w * bits + lowest((*l)[w]);
+      return w;
+    }
+
+    public:
+    template <typename St>
+    void reserve(St&, const std::size_t n) { // the summaries are built again
+      if(n <= covered)
+        return;
+      covered = std::max({n, 2 * covered, bits});
+      levels.resize(1);
+      levels[0].resize((covered + bits - 1) / bits);
+      while(levels.back().size() > 1){
+        const auto& below = levels.back();
+        std::vector<word> above((below.size() + bits - 1) / bits);
+        for(std::size_t w = 0; w < below.size(); ++w)
+          if(below[w])
+            above[w / bits] |= word(1) << w % bits;
+        levels.push_back(std::move(above));
+      }
+    }
+
+    template <typename St>
+    bool empty(const St&) const noexcept { return levels.empty() || !levels.back()[0]; }
+
+    template <typename St>
+    N take(St&, const N hint) noexcept {
+      std::size_t i;
+      const auto near = hint ? levels[0][std::size_t(hint-1) / bits] : word(0);
+      if(near){ // the first free node after the head, or before it, in its word
+        const auto after = near & (~word(0) << std::size_t(hint-1) % bits);
+        i = std::size_t(hint-1) / bits * bits + lowest(after ? after : near);
+      }
+      else
+        i = find_first();
+      reset(i);
+      return N(i+1);
+    }
+
+    template <typename St>
+    void give(St& s, const N head, const N tail) noexcept {
+      for(auto x = head; ; x = s.next(x-1)){
+        set(std::size_t(x-1));
+        if(x == tail)
+          break;
+      }
+    }
+
+    template <typename St, typename F>
+    void for_each(const St&, F f) const {
+      if(levels.empty())
+        return;
+      for(std::size_t w = 0; w < levels[0].size(); ++w)
+        for(auto b = levels[0][w]; b; b &= b - 1)
+          f(w * bits + lowest(b));
+    }
+
+    template <typename St>
+    void forget_from(St&, const std::size_t n) noexcept {
+      if(levels.empty())
+        return;
+      for(std::size_t w = n / bits; w < levels[0].size(); ++w)
+        for(auto b = levels[0][w]; b; b &= b - 1){
+          const auto i = w * bits + lowest(b);
+          if(i >= n)
+            reset(i);
+        }
+    }
+
+    template <typename St>
+    void clear(St&) noexcept {
+      for(auto& l : levels)
+        std::fill(l.begin(), l.end(), word(0));
+    }
+  };
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+// Growth policies for stack_pool. When the pool is full it asks its policy
+//
+//   static size_type next_capacity(capacity, max)
+//
+// for the new capacity, given the current one and the number of addresses N
+// can represent. The result is always in (capacity, max]: when there is no
+// room left the policy throws std::length_error, so running out of addresses
+// fails the same way every time instead of wrapping N around.
+
+namespace growth_detail{
+  template <typename size_type>
+  size_type checked(const size_type capacity, const size_type wanted, const size_type max) {
+    if(capacity >= max)
+      throw std::length_error{"stack_pool: no address left for a new node"};
+    return std::min(std::max(wanted, capacity + 1), max);
+  }
+}
+
+// start at First nodes, then multiply the capacity by Num/Den
+template <std::size_t Num = 2, std::size_t Den = 1, std::size_t First = 8>
+struct geometric_growth{
+  static_assert(Num > Den && Den > 0, "the factor must be larger than 1");
+  template <typename size_type>
+  static size_type next_capacity(const size_type capacity, const size_type max) {
+    if(!capacity)
+      return growth_detail::checked(capacity, size_type(First), max);
+    const auto wanted = capacity > max / Num ? max : capacity / Den * Num + capacity % Den * Num / Den;
+    return growth_detail::checked(capacity, wanted, max);
+  }
+};
+
+// Step more nodes every time: at most Step-1 nodes are wasted
+template <std::size_t Step>
+struct linear_growth{
+  static_assert(Step > 0, "the step must be positive");
+  template <typename size_type>
+  static size_type next_capacity(const size_type capacity, const size_type max) {
+    const auto wanted = capacity > max - Step ? max : capacity + Step;
+    return growth_detail::checked(capacity, wanted, max);
+  }
+};
+
+// grow as G, but never past Cap nodes
+template <std::size_t Cap, typename G = geometric_growth<>>
+struct capped_growth{
+  template <typename size_type>
+  static size_type next_capacity(const size_type capacity, const size_type max) {
+    const auto cap = std::min(size_type(Cap), max);
+    return G::next_capacity(capacity, cap);
+  }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <vector>
+#include "pool_free.hpp"
+
+// A std::pmr::memory_resource for node-based containers (std::pmr::map,
+// list, unordered_map...): blocks of fixed size recycled like the nodes of a
+// stack_pool. There is a pool per block size, a multiple of
+// alignof(std::max_align_t) up to max_block bytes, and each one keeps its
+// free blocks with a free-node policy of pool_free.hpp, addressed by 1-based
+// indices: allocate and deallocate are O(1) with lifo_free_list. Bigger or
+// over-aligned requests go to the upstream resource, and so do the chunks the
+// blocks are carved from; they go back to it only with release() or the
+// destructor. Not thread safe, like std::pmr::unsynchronized_pool_resource.
+
+namespace pool_resource_detail{
+  // blocks of one size, in chunks of chunk_bytes aligned to chunk_bytes: the
+  // chunk of a block is its address with the low bits cleared, and the first
+  // bytes of a chunk hold the index of its first block, so a pointer turns into
+  // its index without a search. A free block keeps its link in its first
+  // bytes, a block in use has no link at all. Same interface as the storages
+  // of pool_storage.hpp, as far as the free-node policies need it.
+  template <typename N>
+  class block_storage{
+    public:
+    using size_type = std::size_t;
+    static constexpr size_type chunk_bytes = size_type(1) << 16;
+    static constexpr size_type header = alignof(std::max_align_t);
+
+    private:
+    size_type block;
+    size_type per_chunk;
+    std::vector<unsigned char*> chunks;
+    size_type n_blocks{0}; // blocks handed out so far, the high-water mark
+    N free{0};
+    std::pmr::memory_resource* upstream;
+
+    unsigned char* pointer(const size_type i) const noexcept {
+      return chunks[i / per_chunk] + header + i % per_chunk * block;
+    }
+
+    public:
+    block_storage(const size_type bytes, std::pmr::memory_resource* up) noexcept:
+      block{bytes}, per_chunk{(chunk_bytes - header) / bytes}, upstream{up} {}
+    block_storage(const block_storage&) = delete;
+    block_storage& operator=(const block_storage&) = delete;
+    block_storage(block_storage&& s) noexcept:
+      block{s.block}, per_chunk{s.per_chunk}, chunks{std::move(s.chunks)}, n_blocks{s.n_blocks}, free{s.free}, upstream{s.upstream} {
+      s.chunks.clear();
+      s.clear();
+    }
+    ~block_storage() noexcept { release(); }
+
+    void* address(const size_type i) const noexcept { return pointer(i); }
+    size_type index(const void* p) const noexcept {
+      const auto offset = reinterpret_cast<std::uintptr_t>(p) & (chunk_bytes - 1);
+      const auto base = static_cast<const unsigned char*>(p) - offset;
+      return *reinterpret_cast<const size_type*>(base) + (offset - header) / block;
+    }
+
+    N& next(const size_type i) noexcept { return *std::launder(reinterpret_cast<N*>(pointer(i))); }
+    const N& next(const size_type i) const noexcept { return *std::launder(reinterpret_cast<const N*>(pointer(i))); }
+
+    N& free_head() noexcept { return free; }
+    const N& free_head() const noexcept { return free; }
+
+    size_type size() const noexcept { return n_blocks; }
+    size_type capacity() const noexcept { return chunks.size() * per_chunk; }
+
+    void emplace_back() { // a block never used, the chunk is allocated here
+      if(n_blocks == capacity()){
+        chunks.reserve(chunks.size() + 1);
+        const auto c = static_cast<unsigned char*>(upstream->allocate(chunk_bytes, chunk_bytes));
+        ::new (c) size_type(capacity());
+        chunks.push_back(c);
+      }
+      ++n_blocks;
+    }
+
+    void clear() noexcept { n_blocks = 0; free = N(0); } // the chunks are kept
+
+    void release() noexcept {
+      for(auto c : chunks)
+        upstream->deallocate(c, chunk_bytes, chunk_bytes);
+      chunks.clear();
+      clear();
+    }
+  };
+}
+
+template <typename N = std::uint32_t, typename R = lifo_free_list>
+class pool_memory_resource: public std::pmr::memory_resource{
+  using storage_type = pool_resource_detail::block_storage<N>;
+  using free_type = typename R::template type<N>;
+
+  public:
+  static constexpr std::size_t granularity = alignof(std::max_align_t);
+  static constexpr std::size_t max_block = 256;
+
+  private:
+  struct size_class{
+    storage_type blocks;
+    free_type free_slots;
+  };
+  std::vector<size_class> pools; // pools[k] has blocks of (k+1)*granularity bytes
+  std::pmr::memory_resource* upstream;
+
+  static bool pooled(const std::size_t bytes, const std::size_t alignment) noexcept {
+    return bytes <= max_block && alignment <= granularity;
+  }
+  static std::size_t class_of(const std::size_t bytes) noexcept {
+    return (std::max(bytes, std::size_t(1)) + granularity - 1) / granularity - 1;
+  }
+
+  public:
+  explicit pool_memory_resource(std::pmr::memory_resource* up = std::pmr::get_default_resource()): upstream{up} {
+    pools.reserve(max_block / granularity);
+    for(std::size_t b = granularity; b <= max_block; b += granularity)
+      pools.push_back(size_class{storage_type{b, up}, free_type{}});
+  }
+  pool_memory_resource(const pool_memory_resource&) = delete;
+  pool_memory_resource& operator=(const pool_memory_resource&) = delete;
+  ~pool_memory_resource() override = default;
+
+  std::pmr::memory_resource* upstream_resource() const noexcept { return upstream; }
+
+  // every chunk goes back upstream, even if some of its blocks are still in
+  // use; the blocks allocated directly upstream are not touched
+  void release() noexcept {
+    for(auto& p : pools){
+      p.free_slots.clear(p.blocks);
+      p.blocks.release();
+    }
+  }
+
+  // blocks in use in the pool of requests of that many bytes, 0 past
+  // max_block: those go upstream
+  std::size_t in_use(const std::size_t bytes) const noexcept {
+    if(!pooled(bytes, 1))
+      return 0;
+    const auto& p = pools[class_of(bytes)];
+    std::size_t n_free = 0;
+    p.free_slots.for_each(p.blocks, [&n_free](std::size_t){ ++n_free; });
+    return p.blocks.size() - n_free;
+  }
+
+  protected:
+  void* do_allocate(const std::size_t bytes, const std::size_t alignment) override {
+    if(!pooled(bytes, alignment))
+      return upstream->allocate(bytes, alignment);
+    auto& p = pools[class_of(bytes)];
+    if(!p.free_slots.empty(p.blocks))
+      return p.blocks.address(p.free_slots.take(p.blocks, N(0)) - 1);
+    const auto n = p.blocks.size();
+    if(n >= std::size_t(std::numeric_limits<N>::max()))
+      throw std::bad_alloc{};
+    p.free_slots.reserve(p.blocks, n + 1);
+    p.blocks.emplace_back();
+    return p.blocks.address(n);
+  }
+
+  void do_deallocate(void* x, const std::size_t bytes, const std::size_t alignment) override {
+    if(!pooled(bytes, alignment)){
+      upstream->deallocate(x, bytes, alignment);
+      return;
+    }
+    auto& p = pools[class_of(bytes)];
+    const auto i = N(p.blocks.index(x) + 1);
+    ::new (x) N(0); // the block now holds a link
+    p.free_slots.give(p.blocks, i, i);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& x) const noexcept override { return this == &x; }
+};
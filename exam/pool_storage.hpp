@@ -0,0 +1,403 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "pool_growth.hpp"
+
+// Storage policies for stack_pool. A policy is a tag whose nested
+// type<T,N> stores the nodes at 0-based indices (stack_pool adds the +1),
+// and whose growth is the default growth policy (see pool_growth.hpp).
+// The values are raw memory: stack_pool constructs and destroys them, the
+// storage only has to keep them in place or relocate the live ones.
+//
+//   T& value(i), N& next(i)     access a node, the value may be unconstructed
+//   N& free_head()              the head of the free nodes, end (0) when empty
+//   size(), capacity()          nodes handed out so far and allocated nodes
+//   reserve(n, live)            allocate room for n nodes, a storage that moves
+//                               its nodes relocates the values i with live(i);
+//                               returns the bytes it moved
+//   emplace_back(next)          add node size() pointing to next, the nodes
+//                               past size() are never touched
+//   clear()                     forget every node and the free nodes, keep the
+//                               memory
+//   shrink_to_fit(n, live)      drop the nodes from n on (none is live) and
+//                               give back the memory they used
+//
+// A storage that outlives its pool may also have live(), where stack_pool
+// keeps its count of live nodes: a pool adopting it needs no walk to count
+// them (see mapped_storage).
+//
+// Copies copy the links, free_head() included, and the raw bytes: stack_pool
+// then copy-constructs the live values on top of them.
+
+
+// room for a T whose lifetime is managed by stack_pool
+template <typename T>
+struct raw_value{
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type bytes;
+  raw_value() noexcept {} // no value-initialization: nothing is touched
+  T& get() noexcept { return *reinterpret_cast<T*>(&bytes); }
+  const T& get() const noexcept { return *reinterpret_cast<const T*>(&bytes); }
+};
+
+// move (copy, if moving may throw) the live values from(i) of [0,n) to to(i),
+// the originals are destroyed only once every value has been constructed
+template <typename T, typename From, typename To, typename F>
+void relocate_values(const std::size_t n, From from, To to, F& live) {
+  std::size_t i = 0;
+  try {
+    for(; i < n; ++i)
+      if(live(i))
+        ::new (to(i)) T(std::move_if_noexcept(*from(i)));
+  } catch(...) {
+    while(i--)
+      if(live(i))
+        to(i)->~T();
+    throw;
+  }
+  for(i = 0; i < n; ++i)
+    if(live(i))
+      from(i)->~T();
+}
+
+
+// all the nodes in a single std::vector: growth relocates every node
+struct vector_storage{
+  using growth = geometric_growth<>; // start at 8, then double
+  template <typename T, typename N>
+  class type{
+    struct node_t{
+      raw_value<T> value;
+      N next;
+      explicit node_t(const N x) noexcept: next{x} {}
+    };
+
+    std::vector<node_t> nodes;
+    N free{0};
+
+    public:
+    using size_type = typename std::vector<node_t>::size_type;
+
+    T& value(const size_type i) noexcept { return nodes[i].value.get(); }
+    const T& value(const size_type i) const noexcept { return nodes[i].value.get(); }
+
+    N& next(const size_type i) noexcept { return nodes[i].next; }
+    const N& next(const size_type i) const noexcept { return nodes[i].next; }
+
+    N& free_head() noexcept { return free; }
+    const N& free_head() const noexcept { return free; }
+
+    size_type size() const noexcept { return nodes.size(); }
+    size_type capacity() const noexcept { return nodes.capacity(); }
+
+    private:
+    // move every node to a buffer of exactly n nodes, by hand: the vector
+    // would move the bytes of values that are not trivially copyable
+    template <typename F>
+    void reallocate(const size_type n, F& live) {
+      std::vector<node_t> tmp;
+      tmp.reserve(n);
+      for(const auto& x : nodes)
+        tmp.emplace_back(x.next);
+      relocate_values<T>(size(), [this](size_type i){ return &value(i); },
+                         [&tmp](size_type i){ return &tmp[i].value.get(); }, live);
+      nodes.swap(tmp);
+    }
+
+    public:
+    template <typename F>
+    size_type reserve(const size_type n, F&& live) {
+      if(n <= capacity())
+        return 0;
+      if(std::is_trivially_copyable<T>::value) // the vector may move the bytes
+        nodes.reserve(n);
+      else
+        reallocate(n, live);
+      return size() * sizeof(node_t);
+    }
+    void emplace_back(const N x) { nodes.emplace_back(x); }
+    void clear() noexcept { nodes.clear(); free = N(0); }
+
+    template <typename F>
+    void shrink_to_fit(const size_type n, F&& live) {
+      nodes.erase(nodes.begin() + n, nodes.end());
+      if(std::is_trivially_copyable<T>::value)
+        nodes.shrink_to_fit();
+      else
+        reallocate(n, live);
+    }
+  };
+};
+
+
+// structure of arrays: values and links in two separate vectors, so that a
+// walk following next() never drags the values through the cache and small
+// values do not pay for the padding of a node_t
+struct soa_storage{
+  using growth = geometric_growth<>;
+  template <typename T, typename N>
+  class type{
+    std::vector<raw_value<T>> values;
+    std::vector<N> nexts;
+    N free{0};
+
+    public:
+    using size_type = typename std::vector<N>::size_type;
+
+    T& value(const size_type i) noexcept { return values[i].get(); }
+    const T& value(const size_type i) const noexcept { return values[i].get(); }
+
+    N& next(const size_type i) noexcept { return nexts[i]; }
+    const N& next(const size_type i) const noexcept { return nexts[i]; }
+
+    N& free_head() noexcept { return free; }
+    const N& free_head() const noexcept { return free; }
+
+    size_type size() const noexcept { return nexts.size(); }
+    size_type capacity() const noexcept { return nexts.capacity(); }
+
+    private:
+    template <typename F>
+    void reallocate(const size_type n, F& live) {
+      std::vector<raw_value<T>> tmp;
+      tmp.reserve(n);
+      tmp.resize(size());
+      relocate_values<T>(size(), [this](size_type i){ return &value(i); },
+                         [&tmp](size_type i){ return &tmp[i].get(); }, live);
+      values.swap(tmp);
+    }
+
+    public:
+    template <typename F>
+    size_type reserve(const size_type n, F&& live) {
+      if(n <= capacity())
+        return 0;
+      if(std::is_trivially_copyable<T>::value)
+        values.reserve(n);
+      else
+        reallocate(n, live);
+      nexts.reserve(n);
+      return size() * (sizeof(raw_value<T>) + sizeof(N));
+    }
+    void emplace_back(const N x) { values.emplace_back(); nexts.push_back(x); }
+    void clear() noexcept { values.clear(); nexts.clear(); free = N(0); }
+
+    template <typename F>
+    void shrink_to_fit(const size_type n, F&& live) {
+      values.erase(values.begin() + n, values.end());
+      nexts.erase(nexts.begin() + n, nexts.end());
+      if(std::is_trivially_copyable<T>::value)
+        values.shrink_to_fit();
+      else
+        reallocate(n, live);
+      nexts.shrink_to_fit();
+    }
+  };
+};
+
+
+// a table of fixed-size chunks of 2^ChunkBits nodes, indexed by the high bits
+// of the address: growth allocates one more chunk and never moves a node, so
+// references returned by value() survive any push
+template <std::size_t ChunkBits = 12>
+struct chunked_storage{
+  using growth = linear_growth<(std::size_t(1) << ChunkBits)>; // one chunk at a time
+  template <typename T, typename N>
+  class type{
+    struct node_t{
+      raw_value<T> value;
+      N next;
+      explicit node_t(const N x) noexcept: next{x} {}
+    };
+
+    public:
+    using size_type = std::size_t;
+    static constexpr size_type chunk_size = size_type(1) << ChunkBits;
+
+    private:
+    using allocator_type = std::allocator<node_t>;
+    std::vector<node_t*> chunks;
+    size_type n_nodes{0};
+    N free{0};
+
+    node_t& node(const size_type i) noexcept { return chunks[i >> ChunkBits][i & (chunk_size-1)]; }
+    const node_t& node(const size_type i) const noexcept { return chunks[i >> ChunkBits][i & (chunk_size-1)]; }
+
+    void allocate(const size_type n) {
+      allocator_type a;
+      chunks.reserve((n + chunk_size - 1) >> ChunkBits);
+      while(capacity() < n)
+        chunks.push_back(a.allocate(chunk_size));
+    }
+
+    public:
+    type() noexcept = default;
+    type(const type& s): type() {
+      allocate(s.size());
+      free = s.free;
+      for(; n_nodes < s.size(); ++n_nodes)
+        ::new (&node(n_nodes)) node_t(s.node(n_nodes));
+    }
+    type(type&& s) noexcept: chunks{std::move(s.chunks)}, n_nodes{s.n_nodes}, free{s.free} { s.n_nodes = 0; s.chunks.clear(); s.free = N(0); }
+    type& operator=(type s) noexcept {
+      std::swap(chunks, s.chunks);
+      std::swap(n_nodes, s.n_nodes);
+      std::swap(free, s.free);
+      return *this;
+    }
+    ~type() noexcept {
+      allocator_type a;
+      for(auto c : chunks)
+        a.deallocate(c, chunk_size);
+    }
+
+    T& value(const size_type i) noexcept { return node(i).value.get(); }
+    const T& value(const size_type i) const noexcept { return node(i).value.get(); }
+
+    N& next(const size_type i) noexcept { return node(i).next; }
+    const N& next(const size_type i) const noexcept { return node(i).next; }
+
+    N& free_head() noexcept { return free; }
+    const N& free_head() const noexcept { return free; }
+
+    size_type size() const noexcept { return n_nodes; }
+    size_type capacity() const noexcept { return chunks.size()*chunk_size; }
+
+    template <typename F>
+    size_type reserve(const size_type n, F&&) { allocate(n); return 0; } // nothing ever moves
+    void emplace_back(const N x) {
+      if(n_nodes == capacity())
+        allocate(n_nodes+1);
+      ::new (&node(n_nodes)) node_t(x);
+      ++n_nodes;
+    }
+    void clear() noexcept { n_nodes = 0; free = N(0); }
+
+    template <typename F>
+    void shrink_to_fit(const size_type n, F&&) { // whole chunks go back, the rest stays in place
+      n_nodes = n;
+      allocator_type a;
+      while(capacity() >= n + chunk_size){
+        a.deallocate(chunks.back(), chunk_size);
+        chunks.pop_back();
+      }
+      chunks.shrink_to_fit();
+    }
+  };
+};
+
+
+// segment k of a table of segments of doubling size holds 2^(FirstBits+k)
+// nodes: the math shared by segmented_storage and concurrent_stack_pool, for
+// tables of std::atomic pointers to the segments
+template <unsigned FirstBits>
+struct doubling_segments{
+  static constexpr unsigned max_segments = 64 - FirstBits; // for 64-bit indices
+  static std::size_t size(const std::size_t k) noexcept { return std::size_t(1) << (FirstBits + k); }
+  static std::size_t capacity(const std::size_t k) noexcept { return size(k) - size(0); } // nodes in [0,k)
+
+  // node i is in the segment of the most significant bit of i + size(0)
+  template <typename P>
+  static P& at(const std::atomic<P*>* table, const std::size_t i) noexcept {
+    const auto j = i + size(0);
+    const auto b = 63 - unsigned(__builtin_clzll(j));
+    return table[b - FirstBits].load(std::memory_order_acquire)[j - (std::size_t(1) << b)];
+  }
+};
+
+// segments of doubling size in a fixed table, as in concurrent_stack_pool:
+// segment k holds 2^(FirstBits+k) nodes. Nothing ever moves, neither the
+// nodes nor the table, so another thread may read a node it was handed while
+// the owner of the pool keeps pushing and growing it (see sharded_stack_pool.hpp).
+template <unsigned FirstBits = 3>
+struct segmented_storage{
+  using growth = geometric_growth<>; // each growth adds the next segment
+  template <typename T, typename N>
+  class type{
+    struct node_t{
+      raw_value<T> value;
+      N next;
+      explicit node_t(const N x) noexcept: next{x} {}
+    };
+
+    public:
+    using size_type = std::size_t;
+
+    private:
+    using allocator_type = std::allocator<node_t>;
+    using segment = doubling_segments<FirstBits>;
+    static constexpr unsigned max_segments = segment::max_segments;
+    std::atomic<node_t*> segments[max_segments] = {}; // the slots past n_segments are null
+    size_type n_segments{0};
+    size_type n_nodes{0};
+    N free{0};
+
+    node_t& node(const size_type i) const noexcept { return segment::at(segments, i); }
+
+    void allocate(const size_type n) {
+      allocator_type a;
+      for(; capacity() < n; ++n_segments)
+        segments[n_segments].store(a.allocate(segment::size(n_segments)), std::memory_order_release);
+    }
+
+    void deallocate_from(const size_type k) noexcept {
+      allocator_type a;
+      for(; n_segments > k; --n_segments)
+        a.deallocate(segments[n_segments-1].exchange(nullptr, std::memory_order_relaxed), segment::size(n_segments-1));
+    }
+
+    public:
+    type() noexcept = default;
+    type(const type& s): type() {
+      allocate(s.size());
+      free = s.free;
+      for(; n_nodes < s.size(); ++n_nodes)
+        ::new (&node(n_nodes)) node_t(s.node(n_nodes));
+    }
+    type(type&& s) noexcept: type() { swap(s); }
+    type& operator=(type s) noexcept { swap(s); return *this; }
+    ~type() noexcept { deallocate_from(0); }
+
+    void swap(type& s) noexcept {
+      for(size_type k = 0; k < max_segments; ++k)
+        segments[k].store(s.segments[k].exchange(segments[k].load(std::memory_order_relaxed), std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+      std::swap(n_segments, s.n_segments);
+      std::swap(n_nodes, s.n_nodes);
+      std::swap(free, s.free);
+    }
+
+    T& value(const size_type i) noexcept { return node(i).value.get(); }
+    const T& value(const size_type i) const noexcept { return node(i).value.get(); }
+
+    N& next(const size_type i) noexcept { return node(i).next; }
+    const N& next(const size_type i) const noexcept { return node(i).next; }
+
+    N& free_head() noexcept { return free; }
+    const N& free_head() const noexcept { return free; }
+
+    size_type size() const noexcept { return n_nodes; }
+    size_type capacity() const noexcept { return segment::capacity(n_segments); }
+
+    template <typename F>
+    size_type reserve(const size_type n, F&&) { allocate(n); return 0; } // nothing ever moves
+    void emplace_back(const N x) {
+      allocate(n_nodes + 1);
+      ::new (&node(n_nodes)) node_t(x);
+      ++n_nodes;
+    }
+    void clear() noexcept { n_nodes = 0; free = N(0); }
+
+    template <typename F>
+    void shrink_to_fit(const size_type n, F&&) { // the segments past the one of the last node go back
+      n_nodes = n;
+      size_type k = 0;
+      while(segment::capacity(k) < n)
+        ++k;
+      deallocate_from(k);
+    }
+  };
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include "stack_pool.hpp"
+
+template <typename queuepool, typename T, typename N>
+class _queue_iterator;
+
+// A pool of FIFO queues, doubly linked: a queue is the pair of addresses of
+// its front and of its back, its nodes are the nodes of a stack_pool, linked
+// front to back by next() and back to front by prev(). The addresses, the
+// free nodes and the policies S, G and R are those of stack_pool, a dequeued
+// node is recycled by the next enqueue on any queue. Like a stack, a queue is
+// a value: every operation returns the new handle, the old one is stale. The
+// handle also counts the nodes, so that a whole queue is freed in O(1).
+template <typename T, typename N = std::size_t, typename S = vector_storage, typename G = typename S::growth,
+          typename R = lifo_free_list>
+class queue_pool{
+  struct node_t{ // the value of a node of the stack_pool
+    T value;
+    N prev;
+    template <typename... Args>
+    explicit node_t(const N p, Args&&... args): value(std::forward<Args>(args)...), prev{p} {}
+  };
+
+  using pool_type = stack_pool<node_t,N,S,G,R>;
+  pool_type pool;
+  using value_type = T;
+  using size_type = typename S::template type<node_t,N>::size_type;
+
+  public:
+  struct queue_type{
+    N front;
+    N back;
+    N n; // nodes
+    friend bool operator==(const queue_type& x, const queue_type& y) noexcept { return x.front == y.front && x.back == y.back; }
+    friend bool operator!=(const queue_type& x, const queue_type& y) noexcept { return !(x == y); }
+  };
+
+  queue_pool() noexcept = default;
+  explicit queue_pool(const size_type n): pool{n} {} // reserve n nodes in the pool
+
+  queue_type new_queue() const noexcept { return queue_type{end(), end(), N(0)}; } // return an empty queue
+
+  void reserve(const size_type n) { pool.reserve(n); }
+  static constexpr size_type max_size() noexcept { return pool_type::max_size(); }
+  size_type capacity() const noexcept { return pool.capacity(); }
+
+  bool empty(const queue_type q) const noexcept { return q.front == end(); }
+  size_type size(const queue_type q) const noexcept { return q.n; }
+  N end() const noexcept { return N(0); }
+
+  value_type& value(const N x) noexcept { return pool.value(x).value; }
+  const value_type& value(const N x) const noexcept { return pool.value(x).value; }
+
+  N next(const N x) const noexcept { return pool.next(x); } // towards the back
+  N prev(const N x) const noexcept { return pool.value(x).prev; } // towards the front
+
+  value_type& front(const queue_type q) noexcept { return value(q.front); }
+  const value_type& front(const queue_type q) const noexcept { return value(q.front); }
+  value_type& back(const queue_type q) noexcept { return value(q.back); }
+  const value_type& back(const queue_type q) const noexcept { return value(q.back); }
+
+  // construct the new back in place from args
+  template <typename... Args>
+  queue_type emplace(const queue_type q, Args&&... args) {
+    const auto x = pool.emplace(end(), q.back, std::forward<Args>(args)...);
+    if(empty(q))
+      return queue_type{x, x, N(1)};
+    pool.next(q.back) = x;
+    return queue_type{q.front, x, N(q.n + 1)};
+  }
+
+  queue_type enqueue(const value_type& val, const queue_type q) { return emplace(q, val); }
+  queue_type enqueue(value_type&& val, const queue_type q) { return emplace(q, std::move(val)); }
+
+  queue_type dequeue(const queue_type q) noexcept { // remove the front
+    const auto f = pool.pop(q.front);
+    if(f == end())
+      return new_queue();
+    pool.value(f).prev = end();
+    return queue_type{f, q.back, N(q.n - 1)};
+  }
+
+  // the nodes of y follow those of x, in O(1): both handles become stale
+  queue_type concat(const queue_type x, const queue_type y) noexcept {
+    if(empty(x))
+      return y;
+    if(empty(y))
+      return x;
+    pool.next(x.back) = y.front;
+    pool.value(y.front).prev = x.back;
+    return queue_type{x.front, y.back, N(x.n + y.n)};
+  }
+
+  queue_type free_queue(const queue_type q) noexcept {
+    if(!empty(q))
+      pool.free_stack(q.front, q.back, q.n);
+    return new_queue();
+  }
+
+  void clear() noexcept { pool.clear(); } // every queue is gone, the capacity is kept
+
+  const typename pool_type::statistics& counters() const noexcept { return pool.counters(); }
+
+  using iterator = _queue_iterator<queue_pool, value_type, N>;
+  using const_iterator = _queue_iterator<const queue_pool, const value_type, N>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  // from the front to the back; the end knows the back, so that it can be decremented
+  iterator begin(const queue_type q) noexcept { return iterator(this, q.front, q.back); }
+  iterator end(const queue_type q) noexcept { return iterator(this, end(), q.back); }
+
+  const_iterator begin(const queue_type q) const noexcept { return const_iterator(this, q.front, q.back); }
+  const_iterator end(const queue_type q) const noexcept { return const_iterator(this, end(), q.back); }
+
+  const_iterator cbegin(const queue_type q) const noexcept { return begin(q); }
+  const_iterator cend(const queue_type q) const noexcept { return end(q); }
+
+  reverse_iterator rbegin(const queue_type q) noexcept { return reverse_iterator(end(q)); }
+  reverse_iterator rend(const queue_type q) noexcept { return reverse_iterator(begin(q)); }
+
+  const_reverse_iterator rbegin(const queue_type q) const noexcept { return const_reverse_iterator(end(q)); }
+  const_reverse_iterator rend(const queue_type q) const noexcept { return const_reverse_iterator(begin(q)); }
+};
+
+
+template <typename queuepool, typename T, typename N>
+class _queue_iterator{
+  queuepool* pool;
+  N index;
+  N back; // where -- goes from the end
+  public:
+  using value_type = typename std::remove_const<T>::type;
+  using reference = T&;
+  using pointer = T*;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+
+  _queue_iterator() noexcept: pool{nullptr}, index{0}, back{0} {}
+  _queue_iterator(queuepool* p, const N x, const N b) noexcept: pool{p}, index{x}, back{b} {}
+  reference operator*() const noexcept { return pool->value(index); }
+  pointer operator->() const noexcept { return &**this; }
+  _queue_iterator& operator++() noexcept {
+    index = pool->next(index);
+    return *this;
+  }
+  _queue_iterator operator++(int) noexcept {
+    auto tmp = *this;
+    ++(*this);
+    return tmp;
+  }
+  _queue_iterator& operator--() noexcept {
+    index = index ? pool->prev(index) : back;
+    return *this;
+  }
+  _queue_iterator operator--(int) noexcept {
+    auto tmp = *this;
+    --(*this);
+    return tmp;
+  }
+  friend bool operator==(const _queue_iterator& x, const _queue_iterator& y) noexcept {
+    return x.index == y.index;
+  }
+  friend bool operator!=(const _queue_iterator& x, const _queue_iterator& y) noexcept {
+    return !(x == y);
+  }
+};
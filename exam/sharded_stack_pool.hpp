@@ -0,0 +1,196 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "stack_pool.hpp"
+
+// A pool made of one stack_pool per thread, for stacks that are pushed by a
+// thread and popped by another. Each shard is used by one thread at a time, its
+// owner, that pushes on its own nodes without any synchronization; the address
+// of a node carries the id of its shard in the high ShardBits bits, so any
+// thread can read any node (the links of a stack may cross shards). A thread
+// that frees a node of another shard does not touch that shard: the address
+// goes into a batch for the owner, and full batches are posted on the owner's
+// remote-free list, lock-free, many producers and a single consumer. The owner
+// drains it, destroying the values and recycling the nodes, when it pushes and
+// finds something there, or with drain().
+//
+// The handle of a stack must be handed from a thread to another with the usual
+// synchronization (a mutex, an atomic with acquire/release...), as the nodes
+// are written without any. The shards keep their nodes in segmented_storage,
+// where nothing moves when the owner grows its shard.
+template <typename T, typename N = std::uint64_t, unsigned ShardBits = 8>
+class sharded_stack_pool{
+  static_assert(ShardBits < 8 * sizeof(N), "no bits left for the addresses in a shard");
+  static constexpr unsigned local_bits = 8 * sizeof(N) - ShardBits;
+  static constexpr N local_mask = N(~N(0)) >> ShardBits;
+
+  // a shard never asks for more nodes than its addresses can tell apart
+  using pool_type = stack_pool<T, N, segmented_storage<>, capped_growth<local_mask>>;
+  using stack_type = N;
+  using value_type = T;
+  using size_type = std::size_t;
+  static constexpr size_type batch_size = 256;
+
+  struct batch{ // addresses in the shard it is posted to
+    batch* next;
+    size_type n;
+    N nodes[batch_size];
+  };
+
+  struct shard_data{
+    pool_type pool;
+    std::vector<batch*> outgoing; // a batch being filled for each shard
+    alignas(64) std::atomic<batch*> remote{nullptr}; // written by the other threads, on a line of its own
+  };
+  std::vector<std::unique_ptr<shard_data>> shards;
+
+  static size_type shard_of(const stack_type x) noexcept { return size_type(x >> local_bits); }
+  static stack_type local(const stack_type x) noexcept { return x & local_mask; }
+  static stack_type global(const size_type s, const stack_type x) noexcept { return stack_type(s) << local_bits | x; }
+
+  const pool_type& owner(const stack_type x) const noexcept { return shards[shard_of(x)]->pool; }
+
+  void post(batch* b, const size_type to) noexcept { // on the remote-free list of shard to
+    auto& head = shards[to]->remote;
+    b->next = head.load(std::memory_order_relaxed);
+    while(!head.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+
+  public:
+  class shard_view;
+
+  explicit sharded_stack_pool(const size_type n_shards) {
+    if(!n_shards || n_shards > (size_type(1) << ShardBits))
+      throw std::length_error{"sharded_stack_pool: too many shards"};
+    shards.reserve(n_shards);
+    for(size_type s = 0; s < n_shards; ++s){
+      shards.emplace_back(new shard_data);
+      shards.back()->outgoing.assign(n_shards, nullptr);
+    }
+  }
+  sharded_stack_pool(const sharded_stack_pool&) = delete;
+  sharded_stack_pool& operator=(const sharded_stack_pool&) = delete;
+  ~sharded_stack_pool() noexcept { // every thread is done: every batch is drained
+    for(size_type s = 0; s < shards.size(); ++s)
+      shard_view{this, s}.flush();
+    for(size_type s = 0; s < shards.size(); ++s)
+      shard_view{this, s}.drain();
+  }
+
+  size_type size() const noexcept { return shards.size(); } // the number of shards
+
+  // the shard s, to be used by a single thread at a time
+  shard_view shard(const size_type s) noexcept { return shard_view{this, s}; }
+
+  stack_type new_stack() const noexcept { return end(); }
+  bool empty(const stack_type x) const noexcept { return !local(x); }
+  stack_type end() const noexcept { return stack_type(0); }
+
+  // any node, from any thread that was handed x
+  const value_type& value(const stack_type x) const noexcept { return owner(x).value(local(x)); }
+  stack_type next(const stack_type x) const noexcept { return owner(x).next(local(x)); }
+
+  using const_iterator = _iterator<const sharded_stack_pool, const value_type, stack_type>;
+  const_iterator cbegin(const stack_type x) const { return const_iterator(this,x); }
+  const_iterator cend(const stack_type ) const noexcept { return const_iterator(this,end()); }
+};
+
+
+template <typename T, typename N, unsigned ShardBits>
+class sharded_stack_pool<T,N,ShardBits>::shard_view{
+  sharded_stack_pool* p;
+  size_type id;
+  shard_data& self() const noexcept { return *p->shards[id]; }
+
+  void free_node(const stack_type x) { // the value of a foreign node dies when its owner drains it
+    const auto to = shard_of(x);
+    if(to == id){
+      self().pool.pop(local(x));
+      return;
+    }
+    auto& b = self().outgoing[to];
+    if(!b){
+      b = new batch;
+      b->n = 0;
+    }
+    b->nodes[b->n++] = local(x);
+    if(b->n == batch_size){
+      p->post(b, to);
+      b = nullptr;
+    }
+  }
+
+  public:
+  shard_view(sharded_stack_pool* pool, const size_type s) noexcept: p{pool}, id{s} {}
+
+  size_type id_of() const noexcept { return id; }
+
+  stack_type new_stack() const noexcept { return p->end(); }
+  bool empty(const stack_type x) const noexcept { return p->empty(x); }
+  stack_type end() const noexcept { return p->end(); }
+
+  value_type& value(const stack_type x) noexcept { return p->shards[shard_of(x)]->pool.value(local(x)); }
+  const value_type& value(const stack_type x) const noexcept { return p->value(x); }
+  stack_type next(const stack_type x) const noexcept { return p->next(x); }
+
+  // the new node is in this shard, head may be anywhere
+  template <typename... Args>
+  stack_type emplace(const stack_type head, Args&&... args) {
+    if(self().remote.load(std::memory_order_relaxed))
+      drain();
+    auto& pool = self().pool;
+    // every node of the shard is live: the next one would be past local_mask,
+    // a segment may hold more than that
+    if(pool.counters().live == local_mask)
+      throw std::length_error{"sharded_stack_pool: the shard is full"};
+    return global(id, pool.emplace(head, std::forward<Args>(args)...));
+  }
+  stack_type push(const value_type& val, const stack_type head) { return emplace(head, val); }
+  stack_type push(value_type&& val, const stack_type head) { return emplace(head, std::move(val)); }
+
+  stack_type pop(const stack_type x) {
+    const auto n = next(x);
+    free_node(x);
+    return n;
+  }
+
+  stack_type free_stack(stack_type x) {
+    while(!empty(x))
+      x = pop(x);
+    return x;
+  }
+
+  // post the batches not yet full, e.g. before the thread goes idle
+  void flush() noexcept {
+    for(size_type to = 0; to < self().outgoing.size(); ++to)
+      if(auto& b = self().outgoing[to]){
+        p->post(b, to);
+        b = nullptr;
+      }
+  }
+
+  // recycle the nodes the other shards have freed, returns how many
+  size_type drain() noexcept {
+    size_type n = 0;
+    for(auto b = self().remote.exchange(nullptr, std::memory_order_acquire); b; ){
+      for(size_type i = 0; i < b->n; ++i)
+        self().pool.pop(b->nodes[i]);
+      n += b->n;
+      const auto next = b->next;
+      delete b;
+      b = next;
+    }
+    return n;
+  }
+
+  const typename pool_type::statistics& counters() const noexcept { return self().pool.counters(); }
+
+  using const_iterator = typename sharded_stack_pool::const_iterator;
+  const_iterator cbegin(const stack_type x) const { return p->cbegin(x); }
+  const_iterator cend(const stack_type x) const noexcept { return p->cend(x); }
+};
@@ -0,0 +1,211 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "stack_pool.hpp"
+
+// A stack_pool with one writer and any number of readers that walk the stacks
+// while the writer keeps going, in the way of RCU. Pushing never touches a
+// node that is in a stack, so the only danger for a reader is a node that is
+// popped and then recycled under its feet: pop and free_stack do not free the
+// nodes, they retire them, with the current epoch. A reader pins the epoch for
+// as long as it reads (a snapshot); reclaim() starts a new epoch and frees the
+// nodes retired before the oldest one still pinned.
+//
+// The heads are handed to the readers by the user, e.g. in an std::atomic
+// stored with release: the writer calls reclaim() once the heads it has popped
+// or freed are no longer published, then a reader that pins afterwards cannot
+// find them. A snapshot sees every stack it reaches as it was when it got its
+// head, values included, until it is dropped. The writer takes no lock: push,
+// pop and free_stack do not look at the readers, reclaim() reads one atomic per
+// reader. Nodes live in segmented_storage, where growth never moves or retires
+// a segment, so a reader never needs the writer to wait for it to grow.
+template <typename T, typename N = std::size_t>
+class snapshot_stack_pool{
+  using pool_type = stack_pool<T, N, segmented_storage<>>;
+  using stack_type = N;
+  using value_type = T;
+  using size_type = std::size_t;
+  using epoch_type = std::uint64_t;
+
+  struct retired_chain{ // head..tail, n nodes, popped or freed during epoch
+    N head;
+    N tail;
+    size_type n;
+    epoch_type epoch;
+  };
+
+  struct alignas(64) reader_slot{ // one cache line each, written by its reader
+    std::atomic<epoch_type> pinned{0}; // 0 while the reader is not reading
+    std::atomic<bool> taken{false};
+  };
+
+  pool_type pool;
+  std::atomic<epoch_type> epoch{1};
+  std::unique_ptr<reader_slot[]> slots;
+  size_type n_slots;
+  std::vector<retired_chain> retired; // oldest first, with room for one chain per live node
+  size_type n_retired{0};
+
+  stack_type retire(const stack_type head, const stack_type tail, const size_type n) noexcept {
+    const auto e = epoch.load(std::memory_order_relaxed);
+    n_retired += n;
+    if(!retired.empty() && retired.back().epoch == e && next(retired.back().tail) == head){ // pops in a row
+      retired.back().tail = tail;
+      retired.back().n += n;
+    }
+    else
+      retired.push_back(retired_chain{head, tail, n, e});
+    return end();
+  }
+
+  public:
+  class reader;
+  class snapshot;
+
+  explicit snapshot_stack_pool(const size_type max_readers = 64):
+    slots{new reader_slot[max_readers]}, n_slots{max_readers} {}
+  snapshot_stack_pool(const snapshot_stack_pool&) = delete; // the readers point to it
+  snapshot_stack_pool& operator=(const snapshot_stack_pool&) = delete;
+
+  stack_type new_stack() const noexcept { return end(); }
+  bool empty(const stack_type x) const noexcept { return x == end(); }
+  stack_type end() const noexcept { return stack_type(0); }
+
+  // read only, the readers may be reading the same values
+  const value_type& value(const stack_type x) const noexcept { return pool.value(x); }
+  stack_type next(const stack_type x) const noexcept { return pool.next(x); }
+
+  template <typename... Args>
+  stack_type emplace(const stack_type head, Args&&... args) {
+    const auto live = pool.counters().live + 1;
+    if(retired.capacity() < live) // so that pop and free_stack never allocate
+      retired.reserve(std::max(live, 2 * retired.capacity()));
+    return pool.emplace(head, std::forward<Args>(args)...);
+  }
+  stack_type push(const value_type& val, const stack_type head) { return emplace(head, val); }
+  stack_type push(value_type&& val, const stack_type head) { return emplace(head, std::move(val)); }
+
+  // the node is retired, x and its value stay readable until a reclaim() after
+  // every snapshot that may have it is gone
+  stack_type pop(const stack_type x) noexcept {
+    const auto n = next(x);
+    retire(x, x, 1);
+    return n;
+  }
+
+  stack_type free_stack(const stack_type x) noexcept {
+    if(empty(x))
+      return x;
+    auto tail = x;
+    size_type n = 1;
+    for(; !empty(next(tail)); tail = next(tail))
+      ++n;
+    return retire(x, tail, n);
+  }
+
+  // a new epoch: the readers that pin from now on see the heads published
+  // before. Frees the retired nodes no snapshot can reach, returns how many
+  size_type reclaim() noexcept;
+
+  size_type retired_nodes() const noexcept { return n_retired; } // waiting for the readers
+
+  const typename pool_type::statistics& counters() const noexcept { return pool.counters(); } // retired nodes are live
+
+  using const_iterator = typename pool_type::const_iterator;
+  const_iterator cbegin(const stack_type x) const { return pool.cbegin(x); }
+  const_iterator cend(const stack_type x) const noexcept { return pool.cend(x); }
+};
+
+
+// A thread that reads: it takes one of the max_readers slots of the pool for
+// its whole life, std::length_error if there is none left. A reader must not
+// be shared between threads and pins one snapshot at a time.
+template <typename T, typename N>
+class snapshot_stack_pool<T,N>::reader{
+  const snapshot_stack_pool* p;
+  reader_slot* slot{nullptr};
+
+  public:
+  explicit reader(const snapshot_stack_pool& pool): p{&pool} {
+    for(size_type i = 0; i < p->n_slots && !slot; ++i)
+      if(!p->slots[i].taken.exchange(true, std::memory_order_acquire))
+        slot = &p->slots[i];
+    if(!slot)
+      throw std::length_error{"snapshot_stack_pool: too many readers"};
+  }
+  reader(const reader&) = delete;
+  reader& operator=(const reader&) = delete;
+  ~reader() noexcept { slot->taken.store(false, std::memory_order_release); }
+
+  // std::logic_error if the last snapshot is still there
+  snapshot pin() {
+    if(slot->pinned.load(std::memory_order_relaxed))
+      throw std::logic_error{"snapshot_stack_pool: the reader has a snapshot already"};
+    // if a reclaim() started a new epoch meanwhile, it may not have seen the
+    // old one pinned: pin again, the new one
+    for(auto e = p->epoch.load(); ; ){
+      slot->pinned.store(e);
+      const auto now = p->epoch.load();
+      if(now == e)
+        break;
+      e = now;
+    }
+    return snapshot{p, slot};
+  }
+};
+
+
+// The nodes reachable from any head published before the snapshot was pinned,
+// or retired after, stay as they are until it is dropped. Keep it short: the
+// writer cannot recycle anything retired meanwhile.
+template <typename T, typename N>
+class snapshot_stack_pool<T,N>::snapshot{
+  const snapshot_stack_pool* p;
+  reader_slot* slot;
+  friend class reader;
+  snapshot(const snapshot_stack_pool* pool, reader_slot* s) noexcept: p{pool}, slot{s} {}
+
+  public:
+  snapshot(snapshot&& x) noexcept: p{x.p}, slot{std::exchange(x.slot, nullptr)} {}
+  snapshot& operator=(snapshot&&) = delete;
+  ~snapshot() noexcept {
+    if(slot)
+      slot->pinned.store(0, std::memory_order_release);
+  }
+
+  bool empty(const stack_type x) const noexcept { return p->empty(x); }
+  stack_type end() const noexcept { return p->end(); }
+  const value_type& value(const stack_type x) const noexcept { return p->value(x); }
+  stack_type next(const stack_type x) const noexcept { return p->next(x); }
+
+  const_iterator cbegin(const stack_type x) const { return p->cbegin(x); }
+  const_iterator cend(const stack_type x) const noexcept { return p->cend(x); }
+  const_iterator begin(const stack_type x) const { return p->cbegin(x); }
+  const_iterator end(const stack_type x) const noexcept { return p->cend(x); }
+};
+
+
+template <typename T, typename N>
+typename snapshot_stack_pool<T,N>::size_type snapshot_stack_pool<T,N>::reclaim() noexcept {
+  const auto now = epoch.fetch_add(1) + 1;
+  auto oldest = now; // the oldest epoch pinned
+  for(size_type i = 0; i < n_slots; ++i){
+    const auto e = slots[i].pinned.load();
+    if(e && e < oldest)
+      oldest = e;
+  }
+  size_type freed = 0;
+  auto it = retired.begin();
+  for(; it != retired.end() && it->epoch < oldest; ++it){
+    pool.free_stack(it->head, it->tail, it->n);
+    freed += it->n;
+  }
+  retired.erase(retired.begin(), it);
+  n_retired -= freed;
+  return freed;
+}
@@ -1,49 +1,206 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include <limits>
+#include "pool_free.hpp"
+#include "pool_growth.hpp"
+#include "pool_storage.hpp"
 
 
 template <typename stackpool, typename T, typename N>
 class _iterator;
 
 
-template <typename T, typename N = std::size_t>
+// S says where the nodes live (pool_storage.hpp), G how the pool grows when
+// it is full (pool_growth.hpp), R which free node a push recycles (pool_free.hpp)
+template <typename T, typename N = std::size_t, typename S = vector_storage, typename G = typename S::growth,
+          typename R = lifo_free_list>
 class stack_pool{
 
-  struct node_t{
-    T value;
-    N next;
-    explicit node_t(const N x): value{}, next{x} {} //custom ctor usato in init_free_nodes in emplace_back()
-  };
-
-  std::vector<node_t> pool;
+  using storage_type = typename S::template type<T,N>;
+  storage_type pool; // where the nodes live, see pool_storage.hpp
   using stack_type = N;
   using value_type = T;
-  using size_type = typename std::vector<node_t>::size_type;
-  stack_type free_nodes{stack_type(0)}; // at the beginning, it is empty
+  using size_type = typename storage_type::size_type;
+  using free_type = typename R::template type<N>;
+  free_type free_slots; // the free nodes, at the beginning there are none
+  // nodes past pool.size() have never been used: they are handed out by bumping
+  // the size (the high-water mark), the free list holds only recycled nodes.
+  // A value is alive exactly while its node belongs to a stack: it is
+  // constructed by push/emplace and destroyed by pop/free_stack.
+
+  public:
+  struct statistics{ // kept up to date by every operation
+    size_type live{0}; // nodes in some stack
+    size_type peak_live{0}; // the most live nodes so far
+    size_type growths{0}; // times the capacity grew
+    size_type bytes_moved{0}; // by the storage, when it grew
+  };
+
+  struct report: statistics{ // a scan of the whole pool, see stats()
+    size_type capacity{0};
+    size_type used{0}; // nodes handed out at least once, the high-water mark
+    size_type free{0}; // nodes waiting to be recycled, used - live
+    // locality[s][k] counts the hops of the s-th stack that jump 2^(k-1) < d <= 2^k
+    // nodes away, k = 0 for the hops to a neighbour
+    std::vector<std::vector<size_type>> locality;
+  };
+
+  private:
+  statistics count;
+
+  // while a checkpoint is open: the nodes pushed since the first one, and the
+  // chains popped or freed, whose values are alive until a commit. A chain is
+  // its head and its length, its links are never touched again before the
+  // commit. limbo has room for one chain per live node, so that a pop never
+  // allocates.
+  struct limbo_chain{
+    N head;
+    N n;
+  };
+  struct undo_log{
+    std::vector<N> pushed;
+    std::vector<limbo_chain> limbo;
+    size_type open{0}; // checkpoints not yet rolled back or committed
+  };
+  undo_log undo;
+
+  template <typename V>
+  static void make_room(V& v, const size_type n) { // geometric, as push_back
+    if(v.capacity() < n)
+      v.reserve(std::max(n, 2 * v.capacity()));
+  }
+
+  void make_room_for_push() { // in the log, and in limbo for a pop of the new node
+    make_room(undo.pushed, undo.pushed.size() + 1);
+    make_room(undo.limbo, count.live + 1);
+  }
+
+  stack_type defer(const stack_type head, const size_type n) noexcept { // the chain waits for a commit
+    undo.limbo.push_back(limbo_chain{head, N(n)});
+    return end();
+  }
+
+  void no_checkpoint(const char* what) const {
+    if(undo.open)
+      throw std::logic_error{what};
+  }
+
+  // a storage that outlives the pool keeps the count with the nodes, see mapped_storage::live
+  template <typename St>
+  static auto keep_live(St& s, const size_type n, int) noexcept -> decltype(void(s.live() = n)) { s.live() = n; }
+  template <typename St>
+  static void keep_live(St&, size_type, long) noexcept {}
 
-  node_t& node(const stack_type x) noexcept { return pool[x-1]; }
-  const node_t& node(const stack_type x) const noexcept { return pool[x-1]; }
+  template <typename St>
+  static auto kept_live(const St& s, const free_type&, int) noexcept -> decltype(size_type(s.live())) { return size_type(s.live()); }
+  template <typename St>
+  static size_type kept_live(const St& s, const free_type& f, long) { // not kept: what is not free
+    size_type n_free = 0;
+    f.for_each(s, [&n_free](size_type){ ++n_free; });
+    return s.size() - n_free;
+  }
 
-  void init_free_nodes(const size_type first, const size_type last);
+  void counted_in(const size_type n) noexcept {
+    count.live += n;
+    count.peak_live = std::max(count.peak_live, count.live);
+    keep_live(pool, count.live, 0);
+  }
+
+  void counted_out(const size_type n) noexcept {
+    count.live -= n;
+    keep_live(pool, count.live, 0);
+  }
 
   void check_capacity();
 
-  template <typename X>
-  stack_type _push(X&& val, const stack_type head);
+  stack_type new_node(const stack_type hint); // hint is the head it will be pushed on
+
+  void splice_free(const stack_type head, const stack_type tail) noexcept { free_slots.give(pool, head, tail); }
+
+  void unwind(stack_type head, const stack_type old_head) noexcept { // undo a partial push_range
+    while(head != old_head)
+      head = pop(head);
+  }
+
+  std::vector<bool> free_marks() const; // marks[i] is true if node i+1 is free
+
+  template <typename F>
+  void for_each_live(F f) const;
+
+  void destroy_values() noexcept;
+
+  void copy_values(const stack_pool& x);
+
+  template <typename I>
+  stack_type _push_range(I first, I last, stack_type head, std::input_iterator_tag);
+
+  template <typename I>
+  stack_type _push_range(I first, I last, stack_type head, std::forward_iterator_tag);
 
   public:
 
   stack_pool() noexcept = default; //default ctor
-  stack_pool(const stack_pool&) = default; //copy ctor
-  stack_pool& operator=(const stack_pool&) = default; //copy assignment
-  stack_pool(stack_pool&&) noexcept = default; //move ctor
-  stack_pool& operator=(stack_pool&&) noexcept = default; //move assignment
-  ~stack_pool() noexcept = default; //dtor
+  stack_pool(const stack_pool& x): pool{x.pool}, free_slots{x.free_slots}, count{x.count}, undo{x.undo} { copy_values(x); } //copy ctor
+  stack_pool& operator=(const stack_pool& x) { //copy assignment
+    if(this != &x){
+      auto tmp = x;
+      *this = std::move(tmp);
+    }
+    return *this;
+  }
+  stack_pool(stack_pool&& x) noexcept: pool{std::move(x.pool)}, free_slots{std::move(x.free_slots)}, count{x.count}, undo{std::move(x.undo)} { //move ctor
+    x.pool.clear();
+    x.free_slots = free_type{};
+    x.count = statistics{};
+    x.undo = undo_log{};
+  }
+  stack_pool& operator=(stack_pool&& x) noexcept { //move assignment
+    if(this != &x){
+      destroy_values();
+      pool = std::move(x.pool);
+      free_slots = std::move(x.free_slots);
+      count = x.count;
+      undo = std::move(x.undo);
+      x.pool.clear();
+      x.free_slots = free_type{};
+      x.count = statistics{};
+      x.undo = undo_log{};
+    }
+    return *this;
+  }
+  ~stack_pool() noexcept { destroy_values(); } //dtor
   explicit stack_pool(const size_type n) { reserve(n); } //custom ctor, reserve n nodes in the pool
+  explicit stack_pool(storage_type s): pool{std::move(s)} { // adopt nodes that already exist, e.g. in a file
+    free_slots.reserve(pool, pool.size());
+    counted_in(kept_live(pool, free_slots, 0));
+  }
+
+  storage_type& storage() noexcept { return pool; } // for what only some storages have, e.g. mapped_storage::sync
+  const storage_type& storage() const noexcept { return pool; }
 
   stack_type new_stack() const noexcept { return end(); } // return an empty stack
 
-  void reserve(const size_type n) { init_free_nodes(capacity()+1, n); }// reserve n nodes in the pool
+  void reserve(const size_type n); // reserve n nodes in the pool, nothing is touched
+
+  static constexpr size_type max_size() noexcept { // the addresses N can represent
+    return std::numeric_limits<N>::max() < std::numeric_limits<size_type>::max() ?
+      size_type(std::numeric_limits<N>::max()) : std::numeric_limits<size_type>::max();
+  }
 
   size_type capacity() const noexcept { return pool.capacity(); } // the capacity of the pool
 
@@ -51,22 +208,137 @@ class stack_pool{
 
   stack_type end() const noexcept { return stack_type(0); }
 
-  value_type& value(const stack_type x) noexcept  { return node(x).value; }
-  const value_type& value(const stack_type x) const noexcept  { return node(x).value; }
+  value_type& value(const stack_type x) noexcept  { return pool.value(x-1); }
+  const value_type& value(const stack_type x) const noexcept  { return pool.value(x-1); }
+
+  stack_type& next(const stack_type x) noexcept  { return pool.next(x-1); }
+  const stack_type& next(const stack_type x) const noexcept  { return pool.next(x-1); }
+
+  // construct the new top in place from args
+  template <typename... Args>
+  stack_type emplace(const stack_type head, Args&&... args);
+
+  stack_type push(const value_type& val, const stack_type head) { return emplace(head, val); } //l_value push
+
+  stack_type push(value_type&& val, const stack_type head) { return emplace(head, std::move(val)); }//r-value push
+
+  // push every element of [first,last), *(last-1) ends up on top
+  template <typename I>
+  stack_type push_range(I first, I last, const stack_type head) {
+    if(undo.open) // one push at a time, each one logged
+      return _push_range(first, last, head, std::input_iterator_tag{});
+    return _push_range(first, last, head, typename std::iterator_traits<I>::iterator_category{});
+  }
+
+  stack_type pop(const stack_type x) noexcept;
+
+  // move the top min(n, length) values to out, top first, and free their nodes
+  // at once; std::logic_error if a checkpoint is open, moves cannot be undone
+  template <typename O>
+  stack_type pop_n(const stack_type x, size_type n, O out);
+
+  stack_type free_stack(stack_type x) noexcept;
+
+  // tail is the last node of head and n the number of its nodes: O(1) if T is
+  // trivially destructible, otherwise the values still have to be destroyed
+  // one by one. Without n, the nodes are counted on the way: O(n) whatever T.
+  stack_type free_stack(const stack_type head, const stack_type tail, const size_type n) noexcept;
+  stack_type free_stack(const stack_type head, const stack_type tail) noexcept;
+
+  void clear() noexcept { destroy_values(); pool.clear(); free_slots.clear(pool); count.live = 0; undo = undo_log{}; } // every stack is gone, the capacity is kept, every checkpoint is closed
+
+  const statistics& counters() const noexcept { return count; }
+
+  // Speculative work: after a checkpoint, the pushes are logged and the nodes
+  // popped or freed keep their values, until the checkpoint is either rolled
+  // back (the pushed nodes are freed, and the heads taken before the
+  // checkpoint are valid again, with the values they had) or committed (the
+  // popped nodes are freed at last). Both cost time proportional to the
+  // pushes and pops since the checkpoint. Checkpoints nest: rolling back or
+  // committing one closes those opened after it, and only the outermost
+  // commit frees anything. Popped nodes count as live until then. Values
+  // changed through value() are not restored. pop_n, compact, collect and
+  // load throw std::logic_error while a checkpoint is open.
+  //
+  // checkpoint() costs O(live) memory: it makes room, once, for a popped chain
+  // per live node, so that pop and free_stack never allocate (pushes make room
+  // for their own node). The room is kept, after the commit too, until clear().
+  struct checkpoint_type{
+    size_type pushed;
+    size_type limbo;
+    size_type level;
+  };
+
+  checkpoint_type checkpoint() {
+    make_room(undo.limbo, count.live);
+    return checkpoint_type{undo.pushed.size(), undo.limbo.size(), undo.open++};
+  }
+
+  void rollback(const checkpoint_type cp);
+  void commit(const checkpoint_type cp);
 
-  stack_type& next(const stack_type x) noexcept  { return node(x).next; }
-  const stack_type& next(const stack_type x) const noexcept  { return node(x).next; }
+  // the counters, plus what needs a scan: the free nodes and, for each stack in
+  // [first,last), a histogram of the distances of its hops
+  report stats() const { const stack_type* none = nullptr; return stats(none, none); }
 
-  stack_type push(const value_type& val, const stack_type head) { return _push(val,head); } //l_value push
+  template <typename I>
+  report stats(I first, I last) const;
 
-  stack_type push(value_type&& val, const stack_type head) { return _push(std::move(val),head); }//r-value push
+  void shrink_to_fit(); // trim the free nodes past the last live one and give their memory back
 
-  stack_type pop(const stack_type x);
+  // move the nodes so that each stack in [first,last) is contiguous, in the
+  // order of its walk: the first head becomes 1, its next 2 and so on. Then come
+  // the other live nodes in their order and then the free nodes, linked in
+  // order as one run. Returns the new heads, every other address changes too.
+  template <typename I>
+  std::vector<stack_type> compact(I first, I last);
 
-  stack_type free_stack(stack_type x);
+  // the fraction of the hops along the stacks in [first,last) that do not go
+  // to a neighbouring address: 0 right after compact or for a stack pushed on
+  // fresh nodes, close to 1 when the stacks have been interleaved. The higher
+  // it is, the more a walk pays for misses.
+  template <typename I>
+  double fragmentation(I first, I last) const;
+
+  // f(k, v) for each value v of the k-th stack of [first,last), each stack from
+  // top to bottom, the stacks in no particular order. Up to width walks go on
+  // at once, a hop each in turn, and every hop prefetches the node it reaches:
+  // while it comes from memory the other walks make their hops, instead of
+  // each hop waiting for the one before. For many stacks far from compact.
+  template <typename I, typename F>
+  void for_each_stack(I first, I last, F f, size_type width = 32) const;
+
+  struct collection{ // what collect did
+    size_type reclaimed{0}; // nodes that were live but in none of the stacks
+    double seconds{0};
+  };
+
+  // mark and sweep, for the nodes of stacks whose heads were lost without a
+  // free_stack: the stacks in [first,last) are marked, by up to threads
+  // threads (0: as many as the hardware has, if the pool is big enough to pay
+  // for them), then a single pass over the nodes destroys the values of the
+  // live nodes left unmarked and links every free node in order. Every stack
+  // still in use must be in [first,last), the others are gone.
+  template <typename I>
+  collection collect(I first, I last, unsigned threads = 0);
+
+  // Snapshots, for trivially copyable T only: a header (sizes of T and N, number
+  // of nodes, live nodes, free head, heads), then the values and the links as
+  // two arrays, in the byte order of the machine. save(os) writes every node as
+  // it is. Given the heads of the stacks, save writes the heads as well and, if
+  // compact, only the live nodes, renumbered in order from 1: the free list of
+  // the snapshot is empty and the heads are remapped.
+  void save(std::ostream& os) const { const stack_type* none = nullptr; save(os, none, none, false); }
+
+  template <typename I>
+  void save(std::ostream& os, I first, I last, const bool compact = true) const;
+
+  // replace the whole pool with a snapshot and return its heads; on a bad
+  // snapshot std::runtime_error is thrown and the pool is left empty
+  std::vector<stack_type> load(std::istream& is);
 
   using iterator = _iterator<stack_pool, value_type, stack_type>;
-  using const_iterator = _iterator<stack_pool, const value_type, stack_type>;
+  using const_iterator = _iterator<const stack_pool, const value_type, stack_type>;
 
   iterator begin(const stack_type x) { return iterator(this,x); }
   iterator end(const stack_type ) noexcept { return iterator(this,end()); } // this is not a typo
@@ -79,50 +351,676 @@ class stack_pool{
 };
 
 
-template <typename T, typename N>
-void stack_pool<T,N>::init_free_nodes(const size_type first, const size_type last) {
-  pool.reserve(last);
-  for(auto i = first; i < last; ++i )
-    pool.emplace_back(i + 1); //costruisco i free nodes nuovi utilizzando il custom ctor di node
-  pool.emplace_back(free_nodes); //l'ultimo  free node costruito punta alla vecchia testa dei free_nodes
-  free_nodes = first; //setta il valore della testa dei free_nodes
+template <typename T, typename N, typename S, typename G, typename R>
+std::vector<bool> stack_pool<T,N,S,G,R>::free_marks() const {
+  std::vector<bool> marks(pool.size());
+  free_slots.for_each(pool, [&marks](size_type i){ marks[i] = true; });
+  return marks;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename F>
+void stack_pool<T,N,S,G,R>::for_each_live(F f) const {
+  if(free_slots.empty(pool)){ // no need to look for the free nodes
+    for(size_type i = 0; i < pool.size(); ++i)
+      f(i);
+    return;
+  }
+  const auto marks = free_marks();
+  for(size_type i = 0; i < pool.size(); ++i)
+    if(!marks[i])
+      f(i);
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::destroy_values() noexcept {
+  if(!std::is_trivially_destructible<T>::value)
+    for_each_live([this](size_type i){ pool.value(i).~T(); });
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::copy_values(const stack_pool& x) {
+  if(std::is_trivially_copyable<T>::value) // the storage has already copied the bytes
+    return;
+  std::vector<size_type> done; // to roll back if a copy throws
+  try {
+    x.for_each_live([this,&x,&done](size_type i){
+      ::new (&pool.value(i)) T(x.pool.value(i));
+      done.push_back(i);
+    });
+  } catch(...) {
+    for(auto i : done)
+      pool.value(i).~T();
+    throw;
+  }
 }
 
-template <typename T, typename N>
-void stack_pool<T,N>::check_capacity() {
-  if(!capacity()) reserve(8);
-  if(!empty(free_nodes))
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::reserve(const size_type n) {
+  if(n <= capacity())
+    return;
+  if(n > max_size())
+    throw std::length_error{"stack_pool: cannot address that many nodes"};
+  size_type moved;
+  if(std::is_trivially_copyable<T>::value || free_slots.empty(pool)) // every node is live, or nobody cares
+    moved = pool.reserve(n, [](size_type){ return true; });
+  else{
+    const auto marks = free_marks();
+    moved = pool.reserve(n, [&marks](size_type i){ return !marks[i]; });
+  }
+  ++count.growths;
+  count.bytes_moved += moved;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::shrink_to_fit() {
+  const auto marks = free_marks();
+  auto n = pool.size();
+  while(n && marks[n-1])
+    --n;
+  free_slots.forget_from(pool, n);
+  pool.shrink_to_fit(n, [&marks](size_type i){ return !marks[i]; });
+}
+
+// tmp is raw memory, read only when tmp_live: gcc cannot see it for some T
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+std::vector<N> stack_pool<T,N,S,G,R>::compact(I first, I last) {
+  static_assert(std::is_nothrow_move_constructible<T>::value, "the values are moved around and cannot throw midway");
+  no_checkpoint("stack_pool::compact: a checkpoint is open");
+  const auto n = pool.size();
+  const auto marks = free_marks();
+  std::vector<stack_type> heads(first, last);
+  std::vector<stack_type> to(n, end()); // node i moves to address to[i]
+  stack_type k = end();
+  for(auto h : heads)
+    for(auto x = h; !empty(x) && empty(to[x-1]); x = next(x)) // a shared tail is moved once
+      to[x-1] = ++k;
+  for(size_type i = 0; i < n; ++i)
+    if(!marks[i] && empty(to[i]))
+      to[i] = ++k;
+  const auto live = size_type(k);
+  for(size_type i = 0; i < n; ++i)
+    if(marks[i])
+      to[i] = ++k;
+
+  std::vector<size_type> from(n); // the inverse: position p receives node from[p]
+  for(size_type i = 0; i < n; ++i)
+    from[to[i]-1] = i;
+  const auto remap = [&to](const stack_type x){ return x ? to[x-1] : x; };
+  const auto move_node = [this,&marks,&remap](const size_type i, const size_type p){ // p is raw
+    if(!marks[i]){
+      ::new (&pool.value(p)) T(std::move(pool.value(i)));
+      pool.value(i).~T();
+    }
+    pool.next(p) = remap(pool.next(i));
+  };
+
+  // follow each cycle of the permutation, the first node waits in tmp
+  std::vector<bool> done(n);
+  raw_value<T> tmp;
+  for(size_type i = 0; i < n; ++i){
+    if(done[i])
+      continue;
+    done[i] = true;
+    if(from[i] == i){
+      pool.next(i) = remap(pool.next(i));
+      continue;
+    }
+    const bool tmp_live = !marks[i];
+    if(tmp_live){
+      ::new (&tmp.get()) T(std::move(pool.value(i)));
+      pool.value(i).~T();
+    }
+    const auto tmp_next = remap(pool.next(i));
+    auto p = i;
+    for(; from[p] != i; p = from[p]){
+      move_node(from[p], p);
+      done[from[p]] = true;
+    }
+    if(tmp_live){
+      ::new (&pool.value(p)) T(std::move(tmp.get()));
+      tmp.get().~T();
+    }
+    pool.next(p) = tmp_next;
+  }
+
+  for(size_type i = live; i < n; ++i) // the free nodes, in order
+    pool.next(i) = i + 1 < n ? stack_type(i + 2) : end();
+  free_slots.clear(pool);
+  if(live < n)
+    splice_free(stack_type(live + 1), stack_type(n));
+  for(auto& h : heads)
+    h = remap(h);
+  return heads;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+double stack_pool<T,N,S,G,R>::fragmentation(I first, I last) const {
+  std::size_t hops = 0, jumps = 0;
+  for(; first != last; ++first)
+    for(auto x = *first; !empty(x) && !empty(next(x)); x = next(x)){
+      ++hops;
+      jumps += next(x) != x + 1 && next(x) + 1 != x;
+    }
+  return hops ? double(jumps) / hops : 0.0;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I, typename F>
+void stack_pool<T,N,S,G,R>::for_each_stack(I first, I last, F f, const size_type width) const {
+  struct walk{
+    size_type k; // the position of the stack in [first,last)
+    stack_type x; // the next node to visit, prefetched
+  };
+  const auto prefetch = [this](const stack_type x) noexcept {
+    __builtin_prefetch(&pool.value(x-1));
+    __builtin_prefetch(&pool.next(x-1)); // the same line, unless the storage splits them
+  };
+  size_type k = 0;
+  const auto start = [this, &first, &last, &k, &prefetch](walk& w) { // the next stack that is not empty
+    for(; first != last; ++first, ++k)
+      if(!empty(*first)){
+        w = walk{k++, *first++};
+        prefetch(w.x);
+        return true;
+      }
+    return false;
+  };
+
+  std::vector<walk> walks(std::max(width, size_type(1)));
+  size_type n = 0;
+  while(n < walks.size() && start(walks[n]))
+    ++n;
+  while(n){
+    for(size_type i = 0; i < n; ){
+      auto& w = walks[i];
+      f(w.k, value(w.x));
+      w.x = next(w.x);
+      if(!empty(w.x))
+        prefetch(w.x);
+      else if(!start(w)){ // the last walk takes its place, and its turn
+        w = walks[--n];
+        continue;
+      }
+      ++i;
+    }
+  }
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+typename stack_pool<T,N,S,G,R>::collection stack_pool<T,N,S,G,R>::collect(I first, I last, unsigned threads) {
+  no_checkpoint("stack_pool::collect: a checkpoint is open");
+  using clock = std::chrono::steady_clock;
+  const auto t0 = clock::now();
+  const std::vector<stack_type> heads(first, last);
+  const auto n = pool.size();
+  // 0 unreachable, 1 in a stack, 2 free; bytes, so that threads marking
+  // different stacks never share a word, atomic for stacks that share nodes
+  std::unique_ptr<std::atomic<unsigned char>[]> marks{new std::atomic<unsigned char>[n]()};
+
+  // a walk stops where another one has been: the rest is marked by that one
+  const auto mark = [this, &heads, &marks](const std::size_t from, const std::size_t step) noexcept {
+    for(auto k = from; k < heads.size(); k += step)
+      for(auto x = heads[k]; !empty(x) && !marks[x-1].exchange(1, std::memory_order_relaxed); x = next(x)) {}
+  };
+  if(!threads)
+    threads = n < (size_type(1) << 16) ? 1u : std::max(1u, std::thread::hardware_concurrency());
+  threads = unsigned(std::max<std::size_t>(std::min<std::size_t>(threads, heads.size()), 1));
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+  for(unsigned t = 1; t < threads; ++t)
+    try {
+      workers.emplace_back(mark, t, threads);
+    } catch(const std::system_error&) { // no more threads: this one does their share
+      mark(t, threads);
+    }
+  mark(0, threads);
+  for(auto& w : workers)
+    w.join();
+  free_slots.for_each(pool, [&marks](size_type i){ marks[i].store(2, std::memory_order_relaxed); });
+
+  collection c;
+  stack_type head = end(), tail = end();
+  for(size_type i = 0; i < n; ++i){
+    const auto m = marks[i].load(std::memory_order_relaxed);
+    if(m == 1)
+      continue;
+    const auto x = stack_type(i+1);
+    if(!m){
+      value(x).~T();
+      ++c.reclaimed;
+    }
+    if(empty(tail))
+      head = x;
+    else
+      next(tail) = x;
+    tail = x;
+  }
+  free_slots.clear(pool);
+  if(!empty(head))
+    splice_free(head, tail);
+  counted_out(c.reclaimed);
+  c.seconds = std::chrono::duration<double>(clock::now() - t0).count();
+  return c;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+typename stack_pool<T,N,S,G,R>::report stack_pool<T,N,S,G,R>::stats(I first, I last) const {
+  report r;
+  static_cast<statistics&>(r) = count;
+  r.capacity = capacity();
+  r.used = pool.size();
+  free_slots.for_each(pool, [&r](size_type){ ++r.free; });
+  for(; first != last; ++first){
+    std::vector<size_type> h(8 * sizeof(N) + 1);
+    for(auto x = *first; !empty(x) && !empty(next(x)); x = next(x)){
+      auto d = size_type(next(x) > x ? next(x) - x : x - next(x)) - 1; // 0 for a neighbour
+      size_type k = 0;
+      for(; d; d >>= 1)
+        ++k;
+      ++h[k];
+    }
+    r.locality.push_back(std::move(h));
+  }
+  return r;
+}
+
+namespace snapshot_detail{
+  constexpr std::uint64_t magic = 0x70616e736b617473; // "staksnap"
+  constexpr std::size_t block = 4096; // nodes read or written at once
+
+  struct header{
+    std::uint64_t magic;
+    std::uint32_t value_size, link_size;
+    std::uint64_t nodes, live, free, heads;
+  };
+
+  template <typename X>
+  void write(std::ostream& os, const X* x, const std::size_t n) {
+    os.write(reinterpret_cast<const char*>(x), std::streamsize(n * sizeof(X)));
+  }
+
+  template <typename X>
+  void read(std::istream& is, X* x, const std::size_t n) {
+    if(!is.read(reinterpret_cast<char*>(x), std::streamsize(n * sizeof(X))))
+      throw std::runtime_error{"stack_pool: the snapshot is truncated"};
+  }
+
+  // the bytes left in is, or the most there can be if it cannot seek
+  inline std::uint64_t remaining(std::istream& is) {
+    const auto pos = is.tellg();
+    if(pos == std::istream::pos_type(-1))
+      return std::numeric_limits<std::uint64_t>::max();
+    is.seekg(0, std::ios_base::end);
+    const auto last = is.tellg();
+    is.seekg(pos);
+    return last == std::istream::pos_type(-1) || last < pos ? 0 : std::uint64_t(last - pos);
+  }
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+void stack_pool<T,N,S,G,R>::save(std::ostream& os, I first, I last, const bool compact) const {
+  static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be saved as bytes");
+  namespace sd = snapshot_detail;
+  const auto marks = free_marks();
+  const auto n_free = size_type(std::count(marks.begin(), marks.end(), true));
+  std::vector<stack_type> map; // old address-1 -> new address, if compact
+  if(compact){
+    map.resize(pool.size());
+    stack_type x = end();
+    for(size_type i = 0; i < pool.size(); ++i)
+      if(!marks[i])
+        map[i] = ++x;
+  }
+  const auto remap = [this,&map](const stack_type x){ return map.empty() || empty(x) ? x : map[x-1]; };
+  std::vector<stack_type> free_next; // if not compact, the free nodes are written as a list
+  stack_type free_head = end(), last_free = end();
+  if(!compact){
+    free_next.resize(pool.size());
+    free_slots.for_each(pool, [&](size_type i){
+      (empty(last_free) ? free_head : free_next[last_free-1]) = stack_type(i+1);
+      last_free = stack_type(i+1);
+    });
+  }
+
+  std::vector<stack_type> heads;
+  for(; first != last; ++first)
+    heads.push_back(remap(*first));
+  const sd::header h{sd::magic, sizeof(T), sizeof(N), compact ? pool.size() - n_free : pool.size(),
+                     pool.size() - n_free, free_head, heads.size()};
+  sd::write(os, &h, 1);
+  sd::write(os, heads.data(), heads.size());
+
+  // values, then links, a block at a time
+  std::vector<raw_value<T>> values(sd::block);
+  std::vector<stack_type> links(sd::block);
+  size_type k = 0;
+  for(size_type i = 0; i < pool.size(); ++i){
+    if(!marks[i])
+      std::memcpy(&values[k].get(), &pool.value(i), sizeof(T));
+    else if(compact)
+      continue;
+    else // a free node has no value, only the bytes of its last one
+      std::memset(&values[k].get(), 0, sizeof(T));
+    if(++k == sd::block){
+      sd::write(os, values.data(), k);
+      k = 0;
+    }
+  }
+  sd::write(os, values.data(), k);
+  k = 0;
+  for(size_type i = 0; i < pool.size(); ++i){
+    if(compact && marks[i])
+      continue;
+    links[k] = marks[i] ? free_next[i] : remap(pool.next(i));
+    if(++k == sd::block){
+      sd::write(os, links.data(), k);
+      k = 0;
+    }
+  }
+  sd::write(os, links.data(), k);
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+std::vector<N> stack_pool<T,N,S,G,R>::load(std::istream& is) {
+  static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be loaded as bytes");
+  namespace sd = snapshot_detail;
+  no_checkpoint("stack_pool::load: a checkpoint is open");
+  clear();
+  try {
+    sd::header h;
+    sd::read(is, &h, 1);
+    if(h.magic != sd::magic || h.value_size != sizeof(T) || h.link_size != sizeof(N))
+      throw std::runtime_error{"stack_pool: the snapshot holds a different kind of pool"};
+    // the counts must fit in what is left of the stream, when it can tell
+    const auto left = sd::remaining(is);
+    if(h.nodes > max_size() || h.live > h.nodes || h.free > h.nodes || h.heads > left / sizeof(N) ||
+       h.nodes > (left - h.heads * sizeof(N)) / (sizeof(T) + sizeof(N)))
+      throw std::runtime_error{"stack_pool: the snapshot is corrupted"};
+    // and, if it cannot, nothing is allocated before it is read: a block at a time
+    std::vector<stack_type> heads;
+    std::vector<stack_type> links(std::min(size_type(std::max(h.heads, h.nodes)), sd::block));
+    for(std::uint64_t i = 0; i < h.heads; ){
+      const auto k = size_type(std::min(h.heads - i, std::uint64_t(sd::block)));
+      sd::read(is, links.data(), k);
+      heads.insert(heads.end(), links.begin(), links.begin() + k);
+      i += k;
+    }
+    for(auto x : heads)
+      if(x > h.nodes)
+        throw std::runtime_error{"stack_pool: the snapshot is corrupted"};
+
+    const auto n = size_type(h.nodes);
+    std::vector<raw_value<T>> values(std::min(n, sd::block));
+    for(size_type i = 0; i < n; ){
+      const auto k = std::min(n - i, sd::block);
+      sd::read(is, values.data(), k);
+      if(capacity() < i + k){ // geometric, as if pushed
+        reserve(std::min(n, std::max(i + k, 2 * capacity())));
+        free_slots.reserve(pool, capacity());
+      }
+      for(size_type j = 0; j < k; ++j, ++i){
+        pool.emplace_back(end());
+        std::memcpy(&pool.value(i), &values[j].get(), sizeof(T));
+      }
+    }
+    for(size_type i = 0; i < n; ){
+      const auto k = std::min(n - i, sd::block);
+      sd::read(is, links.data(), k);
+      for(size_type j = 0; j < k; ++j, ++i){
+        if(links[j] > n)
+          throw std::runtime_error{"stack_pool: the snapshot is corrupted"};
+        pool.next(i) = links[j];
+      }
+    }
+    size_type n_free = 0;
+    if(h.free){
+      auto tail = stack_type(h.free);
+      for(n_free = 1; !empty(next(tail)); ++n_free, tail = next(tail))
+        if(n_free == n)
+          throw std::runtime_error{"stack_pool: the snapshot is corrupted"};
+      splice_free(stack_type(h.free), tail);
+    }
+    counted_in(n - n_free);
+    return heads;
+  } catch(...) {
+    clear();
+    throw;
+  }
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::check_capacity() {
+  if(!free_slots.empty(pool) || pool.size() < std::min(pool.capacity(), max_size()))
     return;
   else
-    reserve(capacity()*2);
+    reserve(G::next_capacity(pool.capacity(), max_size())); // throws when N has no address left
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+N stack_pool<T,N,S,G,R>::new_node(const stack_type hint) {
+  check_capacity();
+  if(free_slots.empty(pool)){ // nothing to recycle: bump the high-water mark
+    free_slots.reserve(pool, pool.size() + 1);
+    pool.emplace_back(end());
+    counted_in(1);
+    return stack_type(pool.size());
+  }
+  counted_in(1);
+  return free_slots.take(pool, hint);
 }
 
-template <typename T, typename N>
-template <typename X>
-N stack_pool<T,N>::_push(X&& val, const stack_type head) {
-    check_capacity();
-    auto tmp = free_nodes; //crea una copia di free_nodes
-    free_nodes = next(free_nodes); //la testa dei free nodes viene aggiornata
-    value(tmp) = std::forward<X>(val); //viene inserito il nuovo valore nella posizione libera
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename... Args>
+N stack_pool<T,N,S,G,R>::emplace(const stack_type head, Args&&... args) {
+    if(undo.open)
+      make_room_for_push();
+    auto tmp = new_node(head); //nodo riciclato o mai usato
+    try {
+      ::new (&value(tmp)) T(std::forward<Args>(args)...); //il nuovo valore viene costruito nella posizione libera
+    } catch(...) {
+      splice_free(tmp, tmp); // the node goes back, the stack is untouched
+      counted_out(1);
+      throw;
+    }
+    if(undo.open)
+      undo.pushed.push_back(tmp);
     next(tmp) = head; //la nuova testa (tmp) viene agganciata alla vecchia testa della stack
     return tmp; //ritorna il valore della nuova testa della stack
 }
 
-template <typename T, typename N>
-N stack_pool<T,N>::pop(const stack_type x) {
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+N stack_pool<T,N,S,G,R>::_push_range(I first, I last, stack_type head, std::input_iterator_tag) {
+  const auto old_head = head;
+  try {
+    for(; first != last; ++first)
+      head = push(*first, head);
+  } catch(...) {
+    unwind(head, old_head);
+    throw;
+  }
+  return head;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename I>
+N stack_pool<T,N,S,G,R>::_push_range(I first, I last, stack_type head, std::forward_iterator_tag) {
+  const auto old_head = head;
+  try {
+    for(; first != last && !free_slots.empty(pool); ++first){ // recycled nodes first
+      const auto tmp = free_slots.take(pool, head);
+      try {
+        ::new (&value(tmp)) T(*first);
+      } catch(...) {
+        splice_free(tmp, tmp);
+        throw;
+      }
+      counted_in(1);
+      next(tmp) = head;
+      head = tmp;
+    }
+  } catch(...) {
+    unwind(head, old_head);
+    throw;
+  }
+  const auto n = size_type(std::distance(first, last));
+  try {
+    if(pool.size() + n > pool.capacity()) // grow once for the whole range
+      reserve(std::max(G::next_capacity(pool.capacity(), max_size()), pool.size() + n));
+    free_slots.reserve(pool, pool.size() + n);
+  } catch(...) {
+    unwind(head, old_head);
+    throw;
+  }
+  // then a run of fresh nodes, each one pointing to the one before
+  for(; first != last; ++first){
+    pool.emplace_back(head);
+    const auto tmp = stack_type(pool.size());
+    try {
+      ::new (&value(tmp)) T(*first);
+    } catch(...) {
+      splice_free(tmp, tmp);
+      unwind(head, old_head);
+      throw;
+    }
+    counted_in(1);
+    head = tmp;
+  }
+  return head;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+template <typename O>
+N stack_pool<T,N,S,G,R>::pop_n(const stack_type x, size_type n, O out) {
+  no_checkpoint("stack_pool::pop_n: a checkpoint is open");
+  if(!n || empty(x))
+    return x;
+  auto last = x;
+  for(;;){
+    *out = std::move(value(last));
+    ++out;
+    value(last).~T();
+    counted_out(1);
+    if(!--n || empty(next(last)))
+      break;
+    last = next(last);
+  }
+  const auto tmp = next(last);
+  splice_free(x, last); // the popped nodes are still linked: splice them
+  return tmp;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+N stack_pool<T,N,S,G,R>::pop(const stack_type x) noexcept {
     auto tmp = next(x); //tmp è la testa della stack
-    next(x) = free_nodes; //la nuova testa dei free nodes (x) punta alla vecchia testa dei free nodes (free_nodes)
-    free_nodes = x; // la testa dei free nodes viene aggiornata
+    if(undo.open){ // the node and its value wait for a commit
+      defer(x, 1);
+      return tmp;
+    }
+    value(x).~T(); // il valore muore con il nodo
+    splice_free(x, x); // il nodo torna tra i free nodes
+    counted_out(1);
     return tmp; // ritorna la nuova testa della stack
 } // delete first node
 
-template <typename T, typename N>
-N stack_pool<T,N>::free_stack(stack_type x) {
-  while(!empty(x))
-    x = pop(x);
-  return x;
+template <typename T, typename N, typename S, typename G, typename R>
+N stack_pool<T,N,S,G,R>::free_stack(stack_type x) noexcept {
+  if(empty(x))
+    return x;
+  if(undo.open){
+    size_type n = 1;
+    for(auto y = next(x); !empty(y); y = next(y))
+      ++n;
+    return defer(x, n);
+  }
+  auto tail = x; // the links are reused as they are
+  for(;;){
+    value(tail).~T(); // nothing at all if T is trivially destructible
+    counted_out(1);
+    if(empty(next(tail)))
+      break;
+    tail = next(tail);
+  }
+  splice_free(x, tail);
+  return end();
 } // free entire stack
 
+template <typename T, typename N, typename S, typename G, typename R>
+N stack_pool<T,N,S,G,R>::free_stack(const stack_type head, const stack_type tail, const size_type n) noexcept {
+  if(empty(head))
+    return head;
+  if(undo.open)
+    return defer(head, n);
+  if(!std::is_trivially_destructible<T>::value)
+    for(auto x = head; ; x = next(x)){
+      value(x).~T();
+      if(x == tail)
+        break;
+    }
+  splice_free(head, tail); // the whole chain goes on top of the free nodes
+  counted_out(n);
+  return end();
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+N stack_pool<T,N,S,G,R>::free_stack(const stack_type head, const stack_type tail) noexcept {
+  if(empty(head))
+    return head;
+  size_type n = 1;
+  for(auto x = head; x != tail; x = next(x))
+    ++n;
+  return free_stack(head, tail, n);
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::rollback(const checkpoint_type cp) {
+  if(cp.level >= undo.open || cp.pushed > undo.pushed.size() || cp.limbo > undo.limbo.size())
+    throw std::invalid_argument{"stack_pool::rollback: not an open checkpoint"};
+  for(auto i = undo.pushed.size(); i-- > cp.pushed; ){ // the last pushed is freed first, and recycled last
+    const auto x = undo.pushed[i];
+    value(x).~T();
+    splice_free(x, x);
+    counted_out(1);
+  }
+  undo.pushed.resize(cp.pushed);
+  undo.limbo.resize(cp.limbo); // those nodes are in the stacks again, or were pushed since
+  undo.open = cp.level;
+}
+
+template <typename T, typename N, typename S, typename G, typename R>
+void stack_pool<T,N,S,G,R>::commit(const checkpoint_type cp) {
+  if(cp.level >= undo.open || cp.pushed > undo.pushed.size() || cp.limbo > undo.limbo.size())
+    throw std::invalid_argument{"stack_pool::commit: not an open checkpoint"};
+  undo.open = cp.level;
+  if(undo.open) // an outer checkpoint may still need everything
+    return;
+  for(const auto c : undo.limbo){
+    auto tail = c.head;
+    for(size_type k = 1; ; ++k, tail = next(tail)){
+      value(tail).~T();
+      if(k == size_type(c.n))
+        break;
+    }
+    splice_free(c.head, tail);
+    counted_out(size_type(c.n));
+  }
+  undo.pushed.clear();
+  undo.limbo.clear();
+}
+
 
 template <typename stackpool, typename T, typename N>
 class _iterator{
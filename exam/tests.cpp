@@ -1,7 +1,27 @@
 #include "catch.hpp"
 
 #include "stack_pool.hpp"
+#include "concurrent_stack_pool.hpp"
+#include "mapped_storage.hpp"
+#include "guarded_stack_pool.hpp"
+#include "pool_resource.hpp"
+#include "queue_pool.hpp"
+#include "persistent_stack_pool.hpp"
+#include "sharded_stack_pool.hpp"
+#include "snapshot_stack_pool.hpp"
+#include "../c++/10_efficient_programming/count_operations/instrumented.hpp"
 #include <algorithm> // max_element, min_element
+#include <cstddef> // offsetof
+#include <cstdio> // remove
+#include <cstring> // memcpy
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 SCENARIO("getting confident with the addresses"){
   stack_pool<int, std::size_t> pool{16};
@@ -169,3 +189,1559 @@ SCENARIO("using iterators"){
   }
 
 }
+
+SCENARIO("sharing a concurrent pool among threads"){
+  GIVEN("a concurrent pool and some threads"){
+    concurrent_stack_pool<int, uint32_t> pool{};
+    constexpr int n_threads = 4;
+    constexpr int n = 1000;
+    uint32_t heads[n_threads] = {};
+
+    WHEN("every thread fills its own stack"){
+      std::vector<std::thread> threads;
+      for(int t = 0; t < n_threads; ++t)
+        threads.emplace_back([&pool,&heads,t]{
+          for(int i = 0; i < n; ++i){
+            heads[t] = pool.push(t*n+i, heads[t]);
+            if(i % 3 == 0) // give something back to the shared free list
+              heads[t] = pool.pop(heads[t]);
+          }
+        });
+      for(auto& th : threads)
+        th.join();
+
+      THEN("no node has been handed out twice"){
+        for(int t = 0; t < n_threads; ++t){
+          int expected = n-1;
+          for(auto x = heads[t]; !pool.empty(x); x = pool.next(x), --expected){
+            if(expected % 3 == 0)
+              --expected;
+            REQUIRE(pool.value(x) == t*n+expected);
+          }
+        }
+      }
+
+      THEN("iterators work as in stack_pool"){
+        REQUIRE(*std::max_element(pool.begin(heads[1]), pool.end(heads[1])) == 2*n-2); // 2*n-1 was popped
+      }
+
+      THEN("freed stacks are reused without growing the pool"){
+        const auto capacity = pool.capacity();
+        for(auto& h : heads)
+          h = pool.free_stack(h);
+        auto l = pool.new_stack();
+        for(int i = 0; i < n; ++i)
+          l = pool.push(i, l);
+        REQUIRE(pool.capacity() == capacity);
+      }
+    }
+  }
+}
+
+SCENARIO("per-thread caches in front of a concurrent pool"){
+  GIVEN("a concurrent pool and a cache"){
+    concurrent_stack_pool<int, uint32_t> pool{};
+    concurrent_stack_pool<int, uint32_t>::thread_cache cache{pool, 8};
+    auto l = pool.new_stack();
+
+    WHEN("we push and pop through the cache"){
+      for(int i = 0; i < 100; ++i)
+        l = cache.push(i, l);
+      for(int i = 0; i < 50; ++i)
+        l = cache.pop(l);
+
+      THEN("the stack holds what is left"){
+        REQUIRE(pool.value(l) == 49);
+        REQUIRE(std::distance(pool.begin(l), pool.end(l)) == 50);
+      }
+
+      THEN("the shared list was touched in batches only"){
+        const auto& s = cache.stats();
+        REQUIRE(s.allocations == 100);
+        REQUIRE(s.deallocations == 50);
+        REQUIRE(s.refills == 13); // ceil(100/8)
+        REQUIRE(s.flushes == 5); // 4 nodes left by the refills, then one flush every 8 pops
+        REQUIRE(cache.size() <= 16);
+      }
+
+      THEN("a steady push/pop loop never goes to the shared list"){
+        const auto s = cache.stats();
+        for(int i = 0; i < 1000; ++i)
+          l = cache.pop(cache.push(i, l));
+        REQUIRE(cache.stats().refills == s.refills);
+        REQUIRE(cache.stats().flushes == s.flushes);
+      }
+    }
+  }
+}
+
+SCENARIO("growing a pool made of chunks"){
+  GIVEN("a pool with chunks of 4 nodes"){
+    stack_pool<int, uint16_t, chunked_storage<2>> pool{};
+    auto l = pool.new_stack();
+    l = pool.push(1, l);
+    REQUIRE(pool.capacity() == 4);
+
+    WHEN("we keep a reference and push past many chunks"){
+      auto& first = pool.value(l);
+      for(int i = 2; i <= 100; ++i)
+        l = pool.push(i, l);
+
+      THEN("the pool grew one chunk at a time and the reference is still valid"){
+        REQUIRE(pool.capacity() == 100);
+        REQUIRE(&first == &pool.value(std::uint16_t(1)));
+        first = 42;
+        REQUIRE(*std::min_element(pool.begin(l), pool.end(l)) == 2);
+        REQUIRE(*std::max_element(pool.begin(l), pool.end(l)) == 100);
+      }
+
+      THEN("copies are deep"){
+        auto copy = pool;
+        copy.value(l) = -1;
+        REQUIRE(pool.value(l) == 100);
+        REQUIRE(std::equal(pool.begin(pool.next(l)), pool.end(l), copy.begin(copy.next(l))));
+      }
+    }
+  }
+}
+
+SCENARIO("storing values and links in separate arrays"){
+  GIVEN("a struct of arrays pool"){
+    stack_pool<int, uint16_t, soa_storage> pool{};
+    auto l1 = pool.new_stack();
+    auto l2 = pool.new_stack();
+    for(int i = 0; i < 20; ++i){
+      l1 = pool.push(i, l1);
+      l2 = pool.push(-i, l2);
+    }
+
+    THEN("it behaves as the default layout"){
+      REQUIRE(pool.value(l1) == 19);
+      REQUIRE(*std::min_element(pool.begin(l2), pool.end(l2)) == -19);
+      l1 = pool.free_stack(l1);
+      const auto capacity = pool.capacity();
+      for(int i = 0; i < 20; ++i)
+        l1 = pool.push(i, l1);
+      REQUIRE(pool.capacity() == capacity);
+      REQUIRE(std::distance(pool.cbegin(l1), pool.cend(l1)) == 20);
+    }
+  }
+}
+
+SCENARIO("reserved nodes are handed out lazily"){
+  GIVEN("a pool with a large reservation"){
+    stack_pool<int, std::size_t> pool{1 << 20};
+    REQUIRE(pool.capacity() >= (1 << 20));
+
+    WHEN("we push on two stacks and pop one node"){
+      auto l = pool.new_stack();
+      l = pool.push(10, l);
+      l = pool.push(11, l);
+      auto l2 = pool.new_stack();
+      l2 = pool.push(20, l2);
+      REQUIRE(l == 2);
+      REQUIRE(l2 == 3);
+      l = pool.pop(l);
+
+      THEN("recycled nodes come first, then never used ones in order"){
+        l2 = pool.push(21, l2);
+        REQUIRE(l2 == 2);
+        l2 = pool.push(22, l2);
+        REQUIRE(l2 == 4);
+        REQUIRE(pool.capacity() >= (1 << 20));
+      }
+    }
+  }
+}
+
+SCENARIO("freeing whole stacks in constant time"){
+  GIVEN("a pool with a long stack"){
+    stack_pool<int, uint32_t> pool{};
+    auto l = pool.new_stack();
+    l = pool.push(0, l);
+    const auto tail = l;
+    for(int i = 1; i < 100; ++i)
+      l = pool.push(i, l);
+    const auto capacity = pool.capacity();
+
+    WHEN("we give back the stack knowing its tail and its length"){
+      l = pool.free_stack(l, tail, 100);
+      REQUIRE(pool.empty(l));
+
+      THEN("its nodes are reused first"){
+        auto l2 = pool.new_stack();
+        for(int i = 0; i < 100; ++i)
+          l2 = pool.push(-i, l2);
+        REQUIRE(pool.capacity() == capacity);
+        REQUIRE(*std::min_element(pool.begin(l2), pool.end(l2)) == -99);
+      }
+    }
+
+    WHEN("we know only its tail"){
+      l = pool.free_stack(l, tail);
+      THEN("the nodes are counted on the way"){
+        REQUIRE(pool.empty(l));
+        REQUIRE(pool.counters().live == 0);
+      }
+    }
+
+    WHEN("we clear the pool"){
+      auto l2 = pool.new_stack();
+      l2 = pool.push(1, l2);
+      pool.clear();
+
+      THEN("addresses start again from 1 and the capacity is kept"){
+        l = pool.new_stack();
+        l = pool.push(42, l);
+        REQUIRE(l == 1);
+        REQUIRE(pool.value(l) == 42);
+        REQUIRE(pool.capacity() == capacity);
+      }
+    }
+  }
+}
+
+SCENARIO("pushing and popping in bulk"){
+  GIVEN("a pool with a recycled node"){
+    stack_pool<int, uint16_t> pool{};
+    auto l = pool.new_stack();
+    l = pool.push(-1, l);
+    l = pool.push(-2, l);
+    l = pool.pop(l);
+
+    WHEN("we push a range"){
+      const std::vector<int> v{1,2,3,4,5,6,7,8,9,10};
+      l = pool.push_range(v.begin(), v.end(), l);
+
+      THEN("it is the same as pushing one by one"){
+        REQUIRE(std::equal(v.rbegin(), v.rend(), pool.begin(l)));
+        REQUIRE(pool.value(l) == 10);
+        REQUIRE(*std::min_element(pool.begin(l), pool.end(l)) == -1);
+        REQUIRE(std::distance(pool.begin(l), pool.end(l)) == 11);
+      }
+
+      THEN("we can pop a few values at once"){
+        std::vector<int> out;
+        l = pool.pop_n(l, 4, std::back_inserter(out));
+        REQUIRE(out == std::vector<int>{10,9,8,7});
+        REQUIRE(pool.value(l) == 6);
+        const auto capacity = pool.capacity();
+        l = pool.push_range(out.begin(), out.end(), l);
+        REQUIRE(pool.capacity() == capacity);
+        REQUIRE(pool.value(l) == 7);
+      }
+
+      THEN("popping more than we have empties the stack"){
+        std::vector<int> out;
+        l = pool.pop_n(l, 100, std::back_inserter(out));
+        REQUIRE(pool.empty(l));
+        REQUIRE(out.size() == 11);
+      }
+    }
+  }
+}
+
+SCENARIO("values are constructed in place and destroyed by pop"){
+  using I = instrumented<int>;
+  GIVEN("a pool of instrumented values"){
+    stack_pool<I, uint16_t> pool{16};
+    I::initialize(0);
+    auto l = pool.new_stack();
+
+    WHEN("we push an lvalue, an rvalue and emplace"){
+      const I a{1};
+      l = pool.push(a, l);
+      l = pool.push(I{2}, l);
+      l = pool.emplace(l, 3);
+
+      THEN("no value is default constructed nor assigned"){
+        REQUIRE(I::counts[I::copy_ctor] == 1);
+        REQUIRE(I::counts[I::move_ctor] == 1);
+        REQUIRE(I::counts[I::default_ctor] == 0);
+        REQUIRE(I::counts[I::copy_assign] == 0);
+        REQUIRE(I::counts[I::move_assign] == 0);
+        REQUIRE(I::counts[I::dtor] == 1); // the temporary I{2}
+        REQUIRE(pool.value(l).value == 3);
+      }
+
+      THEN("pop and free_stack destroy the values"){
+        l = pool.pop(l);
+        REQUIRE(I::counts[I::dtor] == 2);
+        l = pool.free_stack(l);
+        REQUIRE(I::counts[I::dtor] == 4);
+      }
+    }
+  }
+
+  GIVEN("a pool going out of scope"){
+    I::initialize(0);
+    {
+      stack_pool<I, uint16_t> pool{};
+      auto l = pool.new_stack();
+      for(int i = 0; i < 5; ++i)
+        l = pool.emplace(l, i);
+      l = pool.pop(l);
+    }
+    THEN("every value has been destroyed exactly once"){
+      REQUIRE(I::counts[I::dtor] == 5);
+    }
+  }
+}
+
+SCENARIO("storing types that are not default constructible or copyable"){
+  struct no_default{
+    int x;
+    explicit no_default(int y): x{y} {}
+  };
+
+  GIVEN("a pool of move-only values"){
+    stack_pool<std::unique_ptr<int>, uint16_t> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 20; ++i)
+      l = pool.push(std::unique_ptr<int>{new int{i}}, l);
+
+    THEN("we can move them in and out"){
+      REQUIRE(*pool.value(l) == 19);
+      std::vector<std::unique_ptr<int>> out;
+      l = pool.pop_n(l, 3, std::back_inserter(out));
+      REQUIRE(*out[2] == 17);
+      REQUIRE(*pool.value(l) == 16);
+    }
+  }
+
+  GIVEN("a pool of values without default ctor"){
+    stack_pool<no_default, uint16_t, chunked_storage<2>> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 10; ++i)
+      l = pool.emplace(l, i);
+    REQUIRE(pool.value(l).x == 9);
+  }
+}
+
+SCENARIO("growing a pool of values that cannot be moved as bytes"){
+  GIVEN("a pool of strings with some free nodes"){
+    stack_pool<std::string, uint16_t> pool{};
+    auto l1 = pool.new_stack();
+    auto l2 = pool.new_stack();
+    for(int i = 0; i < 6; ++i){
+      l1 = pool.push(std::to_string(i), l1);
+      l2 = pool.push(std::string(100, char('a'+i)), l2);
+    }
+    l1 = pool.pop(pool.pop(l1));
+
+    WHEN("the pool grows"){
+      pool.reserve(1000);
+      THEN("the live values are relocated"){
+        REQUIRE(pool.value(l1) == "3");
+        REQUIRE(pool.value(l2) == std::string(100, 'f'));
+        REQUIRE(std::distance(pool.begin(l2), pool.end(l2)) == 6);
+      }
+    }
+
+    WHEN("the pool is copied"){
+      auto copy = pool;
+      REQUIRE(std::equal(pool.begin(l2), pool.end(l2), copy.begin(l2)));
+      copy.value(l1) = "changed";
+      REQUIRE(pool.value(l1) == "3");
+    }
+  }
+}
+
+SCENARIO("giving memory back after a burst"){
+  GIVEN("a pool of strings after a burst"){
+    stack_pool<std::string, uint32_t> pool{};
+    auto l1 = pool.new_stack();
+    auto l2 = pool.new_stack();
+    for(int i = 0; i < 10; ++i)
+      l1 = pool.push(std::to_string(i), l1);
+    auto l3 = pool.new_stack();
+    l3 = pool.push("last", l3);
+    for(int i = 0; i < 1000; ++i)
+      l2 = pool.push(std::string(64, 'x'), l2);
+    l1 = pool.pop(l1); // a free node in the middle of the live ones
+    REQUIRE(pool.capacity() >= 1010);
+
+    WHEN("the burst is freed and the pool shrunk"){
+      l2 = pool.free_stack(l2);
+      pool.shrink_to_fit();
+
+      THEN("only the nodes up to the last live one are kept"){
+        REQUIRE(pool.capacity() == 11);
+        REQUIRE(pool.value(l3) == "last");
+        REQUIRE(pool.value(l1) == "8");
+        REQUIRE(std::distance(pool.begin(l1), pool.end(l1)) == 9);
+      }
+
+      THEN("the pool keeps working, reusing the free node first"){
+        l2 = pool.push("again", l2);
+        REQUIRE(l2 == 10);
+        l2 = pool.push("and again", l2);
+        REQUIRE(pool.value(l2) == "and again");
+        REQUIRE(pool.value(l1) == "8");
+      }
+    }
+  }
+
+  GIVEN("a chunked pool"){
+    stack_pool<int, uint32_t, chunked_storage<4>> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 100; ++i)
+      l = pool.push(i, l);
+    std::vector<int> out;
+    l = pool.pop_n(l, 80, std::back_inserter(out));
+    pool.shrink_to_fit();
+    THEN("whole chunks are released"){
+      REQUIRE(pool.capacity() == 32);
+      REQUIRE(pool.value(l) == 19);
+    }
+  }
+}
+
+SCENARIO("choosing how the pool grows"){
+  GIVEN("a pool whose addresses fit in one byte"){
+    stack_pool<int, uint8_t> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 255; ++i)
+      l = pool.push(i, l);
+
+    THEN("the 256th node cannot be addressed and push fails"){
+      REQUIRE(pool.capacity() == 255);
+      REQUIRE_THROWS_AS(pool.push(255, l), std::length_error);
+      REQUIRE_THROWS_AS(pool.reserve(256), std::length_error);
+    }
+
+    THEN("a range that does not fit is not pushed at all"){
+      std::vector<int> out(5);
+      l = pool.pop_n(l, 5, out.begin());
+      const std::vector<int> v(10, 1);
+      REQUIRE_THROWS_AS(pool.push_range(v.begin(), v.end(), l), std::length_error);
+      REQUIRE(std::distance(pool.begin(l), pool.end(l)) == 250);
+      l = pool.push_range(out.begin(), out.end(), l); // the 5 free nodes are still there
+      REQUIRE(pool.value(l) == 250);
+    }
+
+    THEN("the pool is still usable"){
+      REQUIRE(pool.value(l) == 254);
+      l = pool.pop(l);
+      l = pool.push(42, l);
+      REQUIRE(pool.value(l) == 42);
+    }
+  }
+
+  GIVEN("a pool growing by a fixed step"){
+    stack_pool<int, uint32_t, vector_storage, linear_growth<10>> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 25; ++i)
+      l = pool.push(i, l);
+    REQUIRE(pool.capacity() == 30);
+  }
+
+  GIVEN("a pool growing by 1.5 with a cap"){
+    stack_pool<int, uint32_t, vector_storage, capped_growth<100, geometric_growth<3,2>>> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 13; ++i)
+      l = pool.push(i, l);
+    REQUIRE(pool.capacity() == 18); // 8, 12, 18
+    for(int i = 13; i < 100; ++i)
+      l = pool.push(i, l);
+    REQUIRE(pool.capacity() == 100);
+    REQUIRE_THROWS_AS(pool.push(100, l), std::length_error);
+  }
+}
+
+SCENARIO("keeping the stacks in a file"){
+  using storage = mapped_storage::type<int, uint32_t>;
+  using pool_type = stack_pool<int, uint32_t, mapped_storage>;
+  const std::string path = "stack_pool_test.pool";
+  std::remove(path.c_str());
+
+  GIVEN("a pool stored in a new file"){
+    uint32_t popped;
+    {
+      pool_type pool{storage{path}};
+      auto l1 = pool.new_stack();
+      auto l2 = pool.new_stack();
+      for(int i = 0; i < 3000; ++i){
+        l1 = pool.push(i, l1);
+        l2 = pool.push(-i, l2);
+      }
+      popped = l1;
+      l1 = pool.pop(l1);
+      pool.storage().root(0) = l1;
+      pool.storage().root(1) = l2;
+
+      THEN("the file cannot be opened twice"){
+        REQUIRE_THROWS_AS(storage{path}, std::system_error);
+      }
+    }
+
+    WHEN("it is opened again"){
+      pool_type pool{storage{path}};
+      auto l1 = pool.storage().root(0);
+      auto l2 = pool.storage().root(1);
+
+      THEN("the stacks and the free nodes are still there"){
+        REQUIRE(pool.capacity() >= 6000);
+        REQUIRE(pool.value(l1) == 2998);
+        REQUIRE(*std::min_element(pool.begin(l2), pool.end(l2)) == -2999);
+        REQUIRE(std::distance(pool.begin(l1), pool.end(l1)) == 2999);
+        REQUIRE(pool.push(42, l1) == popped);
+      }
+      THEN("so is the count of live nodes, kept in the file"){
+        REQUIRE(pool.counters().live == 5999);
+        pool.push(42, l1);
+        REQUIRE(pool.storage().live() == 6000);
+        pool.free_stack(l2);
+        REQUIRE(pool.storage().live() == 3000);
+      }
+    }
+
+    WHEN("it is opened as a pool of another type"){
+      REQUIRE_THROWS_AS((mapped_storage::type<double, uint32_t>{path}), std::runtime_error);
+      REQUIRE_THROWS_AS((mapped_storage::type<int, std::size_t>{path}), std::runtime_error);
+    }
+
+    WHEN("the free head points past the nodes"){
+      {
+        storage s{path};
+        s.free_head() = uint32_t(s.size() + 1);
+      }
+      REQUIRE_THROWS_AS(storage{path}, std::runtime_error);
+    }
+
+    WHEN("a link between two free nodes points past them"){
+      {
+        pool_type pool{storage{path}};
+        auto l1 = pool.storage().root(0);
+        for(int i = 0; i < 3; ++i)
+          l1 = pool.pop(l1);
+        pool.storage().root(0) = l1;
+      }
+      {
+        storage s{path};
+        auto x = s.free_head();
+        x = s.next(x-1);
+        s.next(x-1) = uint32_t(s.size() + 1);
+      }
+      REQUIRE_THROWS_AS(storage{path}, std::runtime_error);
+    }
+
+    WHEN("the free nodes go round in a cycle"){
+      {
+        pool_type pool{storage{path}};
+        auto l1 = pool.storage().root(0);
+        for(int i = 0; i < 3; ++i)
+          l1 = pool.pop(l1);
+        pool.storage().root(0) = l1;
+      }
+      {
+        storage s{path};
+        const auto x = s.free_head();
+        s.next(s.next(x-1)-1) = x;
+      }
+      REQUIRE_THROWS_AS(storage{path}, std::runtime_error);
+    }
+
+    WHEN("a root points past the nodes"){
+      {
+        storage s{path};
+        s.root(5) = uint32_t(s.size() + 1);
+      }
+      REQUIRE_THROWS_AS(storage{path}, std::runtime_error);
+    }
+
+    WHEN("it is cleared and shrunk"){
+      pool_type pool{storage{path}};
+      pool.clear();
+      pool.shrink_to_fit();
+      REQUIRE(pool.capacity() == 0);
+      auto l = pool.push(1, pool.new_stack());
+      REQUIRE(l == 1);
+      REQUIRE(pool.storage().root(0) == pool.end());
+    }
+  }
+
+  GIVEN("a pool without a file"){
+    pool_type pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 2000; ++i)
+      l = pool.push(i, l);
+    pool_type other{std::move(pool)};
+    REQUIRE(other.value(l) == 1999);
+    REQUIRE(pool.capacity() == 0);
+    l = other.free_stack(l);
+    REQUIRE(other.push(1, l) == 2000);
+  }
+
+  std::remove(path.c_str());
+}
+
+SCENARIO("shipping a pool as a snapshot"){
+  GIVEN("a pool with holes"){
+    stack_pool<int, uint32_t> pool{};
+    std::vector<uint32_t> heads(3, pool.new_stack());
+    for(int i = 0; i < 300; ++i)
+      heads[i % 3] = pool.push(i, heads[i % 3]);
+    std::vector<int> out(50);
+    heads[1] = pool.pop_n(heads[1], 50, out.begin());
+    std::stringstream ss;
+
+    WHEN("it is saved as it is and loaded"){
+      pool.save(ss);
+      stack_pool<int, uint32_t, chunked_storage<4>> copy{};
+      REQUIRE(copy.load(ss).empty());
+      THEN("the addresses and the free nodes are the same"){
+        for(auto h : heads)
+          REQUIRE(std::equal(pool.begin(h), pool.end(h), copy.begin(h), copy.end(h)));
+        REQUIRE(copy.push(42, copy.new_stack()) == pool.push(42, pool.new_stack()));
+      }
+    }
+
+    WHEN("it is saved twice, a free node holding other bytes the second time"){
+      pool.save(ss);
+      pool.pop(pool.push(12345, pool.new_stack())); // the same free node goes back on top
+      std::stringstream again;
+      pool.save(again);
+      THEN("the snapshots are the same bytes"){
+        REQUIRE(ss.str() == again.str());
+      }
+    }
+
+    WHEN("it is saved without the free nodes"){
+      pool.save(ss, heads.begin(), heads.end());
+      stack_pool<int, uint32_t> copy{};
+      const auto copy_heads = copy.load(ss);
+      THEN("the stacks are the same, the heads are remapped"){
+        REQUIRE(copy_heads.size() == 3);
+        REQUIRE(copy.capacity() == 250);
+        for(std::size_t i = 0; i < 3; ++i)
+          REQUIRE(std::equal(pool.begin(heads[i]), pool.end(heads[i]),
+                             copy.begin(copy_heads[i]), copy.end(copy_heads[i])));
+        REQUIRE(copy.push(42, copy.new_stack()) == 251);
+      }
+    }
+
+    WHEN("the snapshot is loaded as another pool"){
+      pool.save(ss);
+      stack_pool<double, uint32_t> wrong{};
+      REQUIRE_THROWS_AS(wrong.load(ss), std::runtime_error);
+    }
+
+    WHEN("the snapshot is truncated"){
+      pool.save(ss);
+      std::stringstream cut{ss.str().substr(0, ss.str().size() - 1)};
+      stack_pool<int, uint32_t> copy{};
+      auto l = copy.push(1, copy.new_stack());
+      REQUIRE_THROWS_AS(copy.load(cut), std::runtime_error);
+      THEN("the pool is left empty"){
+        l = copy.push(2, copy.new_stack());
+        REQUIRE(l == 1);
+      }
+    }
+
+    WHEN("the header counts more than the snapshot holds"){
+      pool.save(ss, heads.begin(), heads.end());
+      const auto patched = [&ss](const std::size_t offset){
+        auto bytes = ss.str();
+        const std::uint64_t huge = 0xffffffff;
+        std::memcpy(&bytes[offset], &huge, sizeof(huge));
+        return bytes;
+      };
+      struct no_seek: std::stringbuf{ // a pipe, say: nothing tells how much is left
+        using std::stringbuf::stringbuf;
+        pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode) override { return pos_type(-1); }
+      };
+      stack_pool<int, uint32_t> copy{};
+      for(auto offset : {offsetof(snapshot_detail::header, heads), offsetof(snapshot_detail::header, nodes)}){
+        std::stringstream seekable{patched(offset)};
+        REQUIRE_THROWS_AS( copy.load(seekable), std::runtime_error );
+        no_seek buf{patched(offset)};
+        std::istream pipe{&buf};
+        REQUIRE_THROWS_AS( copy.load(pipe), std::runtime_error );
+        REQUIRE(copy.capacity() < 1000000); // nothing reserved up front
+      }
+    }
+  }
+}
+
+SCENARIO("making the stacks contiguous again"){
+  GIVEN("stacks interleaved by churn"){
+    stack_pool<std::string, uint32_t> pool{};
+    std::vector<uint32_t> heads(4, pool.new_stack());
+    for(int i = 0; i < 400; ++i)
+      heads[i % 4] = pool.push(std::to_string(i), heads[i % 4]);
+    for(int i = 0; i < 30; ++i)
+      heads[2] = pool.pop(heads[2]);
+    auto other = pool.push("not compacted", pool.new_stack());
+
+    std::vector<std::vector<std::string>> before;
+    for(auto h : heads)
+      before.emplace_back(pool.begin(h), pool.end(h));
+    REQUIRE(pool.fragmentation(heads.begin(), heads.end()) == 1.0);
+
+    WHEN("the first three stacks are compacted"){
+      const auto moved = pool.compact(heads.begin(), heads.begin() + 3);
+
+      THEN("each of them is a run of addresses, in the order of its walk"){
+        REQUIRE(moved.size() == 3);
+        REQUIRE(moved[0] == 1);
+        REQUIRE(moved[1] == 101);
+        REQUIRE(moved[2] == 201);
+        REQUIRE(pool.fragmentation(moved.begin(), moved.end()) == 0.0);
+        for(std::size_t i = 0; i < 3; ++i)
+          REQUIRE(std::equal(before[i].begin(), before[i].end(), pool.begin(moved[i]), pool.end(moved[i])));
+      }
+
+      THEN("the other live nodes follow, then the free nodes in order"){
+        std::vector<std::string> rest;
+        for(uint32_t x = 271; x <= 371; ++x)
+          rest.push_back(pool.value(x));
+        REQUIRE(rest.front() == "3");
+        REQUIRE(rest.back() == "399");
+        REQUIRE(std::count(rest.begin(), rest.end(), "not compacted") == 1);
+        auto l = pool.new_stack();
+        for(uint32_t i = 372; i <= 401; ++i){
+          l = pool.push("new", l);
+          REQUIRE(l == i);
+        }
+        REQUIRE(l == 401);
+      }
+    }
+
+    WHEN("every stack is compacted"){
+      std::vector<uint32_t> all = heads;
+      all.push_back(other);
+      const auto moved = pool.compact(all.begin(), all.end());
+      REQUIRE(pool.fragmentation(moved.begin(), moved.end()) == 0.0);
+      REQUIRE(moved[4] == 371);
+      REQUIRE(pool.value(moved[4]) == "not compacted");
+      REQUIRE(pool.value(moved[3]) == "399");
+    }
+  }
+}
+
+SCENARIO("recycling the lowest free node"){
+  using pool_type = stack_pool<int, uint32_t, vector_storage, vector_storage::growth, bitmap_free_slots>;
+  GIVEN("a pool tracking its free nodes in a bitmap"){
+    pool_type pool{};
+    auto l1 = pool.new_stack();
+    auto l2 = pool.new_stack();
+    for(int i = 0; i < 10; ++i)
+      l1 = pool.push(i, l1);
+    for(int i = 10; i < 20; ++i)
+      l2 = pool.push(i, l2);
+    l1 = pool.free_stack(l1);
+    l2 = pool.pop(l2);
+
+    THEN("a new stack gets the lowest free nodes, in order"){
+      auto l = pool.new_stack();
+      for(uint32_t i = 1; i <= 10; ++i){
+        l = pool.push(int(i), l);
+        REQUIRE(l == i);
+      }
+      REQUIRE(pool.push(11, l) == 20);
+      REQUIRE(pool.push(12, l) == 21);
+    }
+
+    THEN("a push prefers a free node next to its head"){
+      REQUIRE(l2 == 19);
+      REQUIRE(pool.push(42, l2) == 20);
+      const std::vector<uint32_t> heads{l2};
+      REQUIRE(pool.fragmentation(heads.begin(), heads.end()) == 0.0);
+    }
+
+    WHEN("it is copied, compacted, saved and loaded"){
+      auto copy = pool;
+      REQUIRE(copy.push(1, copy.new_stack()) == 1);
+      const std::vector<uint32_t> heads{l2};
+      const auto moved = pool.compact(heads.begin(), heads.end());
+      REQUIRE(moved[0] == 1);
+      REQUIRE(pool.push(42, pool.new_stack()) == 10);
+      std::stringstream ss;
+      pool.save(ss);
+      pool_type loaded{};
+      loaded.load(ss);
+      REQUIRE(std::equal(pool.begin(1), pool.end(1), loaded.begin(1), loaded.end(1)));
+      REQUIRE(loaded.push(1, loaded.new_stack()) == 11);
+    }
+  }
+
+  GIVEN("the same churn on a list and on a bitmap"){
+    stack_pool<int, uint32_t> list{};
+    pool_type bitmap{};
+    std::vector<uint32_t> l(7, list.new_stack()), b(7, bitmap.new_stack());
+    for(int i = 0; i < 20000; ++i){
+      const auto k = std::size_t(i * 7919 % 7);
+      if(i % 5 == 3){
+        l[k] = list.free_stack(l[k]);
+        b[k] = bitmap.free_stack(b[k]);
+      } else if(i % 3 == 1 && !list.empty(l[k])){
+        l[k] = list.pop(l[k]);
+        b[k] = bitmap.pop(b[k]);
+      } else {
+        l[k] = list.push(i, l[k]);
+        b[k] = bitmap.push(i, b[k]);
+      }
+    }
+    THEN("the stacks hold the same values and the bitmap uses no more nodes"){
+      for(std::size_t k = 0; k < 7; ++k)
+        REQUIRE(std::equal(list.begin(l[k]), list.end(l[k]), bitmap.begin(b[k]), bitmap.end(b[k])));
+      REQUIRE(bitmap.capacity() <= list.capacity());
+      bitmap.shrink_to_fit();
+      for(std::size_t k = 0; k < 7; ++k)
+        REQUIRE(std::equal(list.begin(l[k]), list.end(l[k]), bitmap.begin(b[k]), bitmap.end(b[k])));
+    }
+  }
+}
+
+SCENARIO("catching stale handles"){
+  GIVEN("a guarded pool"){
+    guarded_stack_pool<int, uint32_t> pool{};
+    auto l1 = pool.new_stack();
+    for(int i = 0; i < 5; ++i)
+      l1 = pool.push(i, l1);
+    const auto stale = l1;
+    l1 = pool.pop(l1);
+    auto l2 = pool.push(42, pool.new_stack());
+
+    THEN("the node is reused, but the old handle is refused"){
+      REQUIRE(uint32_t(l2) == uint32_t(stale));
+      REQUIRE(pool.value(l2) == 42);
+      REQUIRE_FALSE(pool.valid(stale));
+      REQUIRE_THROWS_AS(pool.value(stale), std::invalid_argument);
+      REQUIRE_THROWS_AS(pool.push(1, stale), std::invalid_argument);
+      REQUIRE_THROWS_AS(pool.pop(stale), std::invalid_argument);
+      REQUIRE(pool.value(l2) == 42);
+    }
+
+    THEN("the links are valid handles"){
+      REQUIRE(pool.value(l1) == 3);
+      REQUIRE(pool.value(pool.next(l1)) == 2);
+      REQUIRE(std::distance(pool.begin(l1), pool.end(l1)) == 4);
+      REQUIRE(*std::max_element(pool.cbegin(l1), pool.cend(l1)) == 3);
+    }
+
+    WHEN("whole stacks are freed"){
+      const auto middle = pool.next(l1);
+      std::vector<int> out(2);
+      const auto rest = pool.pop_n(l1, 2, out.begin());
+      REQUIRE_FALSE(pool.valid(middle));
+      REQUIRE(pool.valid(rest));
+      pool.free_stack(rest);
+      REQUIRE_FALSE(pool.valid(rest));
+      pool.clear();
+      REQUIRE_FALSE(pool.valid(l2));
+      REQUIRE(pool.valid(pool.end()));
+    }
+
+    THEN("a handle out of range is refused too"){
+      const auto far = uint64_t(1000000); // generation 0, past every node
+      REQUIRE_FALSE(pool.valid(far));
+      REQUIRE_THROWS_AS(pool.value(far), std::invalid_argument);
+      REQUIRE_THROWS_AS(pool.next(far), std::invalid_argument);
+      REQUIRE_THROWS_AS(pool.pop(far), std::invalid_argument);
+      auto moved = std::move(pool); // pool keeps no node
+      REQUIRE_THROWS_AS(pool.value(l2), std::invalid_argument);
+      REQUIRE(moved.value(l2) == 42);
+    }
+
+    THEN("so is a handle to a node reserved but never handed out"){
+      REQUIRE(pool.capacity() == 8); // 5 nodes handed out
+      for(uint64_t a = 6; a <= 8; ++a){
+        REQUIRE_FALSE(pool.valid(a));
+        REQUIRE_THROWS_AS(pool.pop(a), std::invalid_argument);
+      }
+      const auto a = pool.push(1, pool.new_stack());
+      const auto b = pool.push(2, pool.new_stack());
+      REQUIRE(a != b);
+      REQUIRE(pool.value(a) == 1);
+      REQUIRE(pool.counters().live == 7);
+    }
+
+    WHEN("the pool is cleared and used again"){
+      pool.clear();
+      const auto l = pool.push(7, pool.new_stack());
+      THEN("the new handles are valid, the old ones are not"){
+        REQUIRE(uint32_t(l) == 1);
+        REQUIRE(pool.value(l) == 7);
+        REQUIRE_FALSE(pool.valid(l1));
+        REQUIRE_FALSE(pool.valid(uint64_t(2))); // generation 0, never handed out since
+      }
+    }
+  }
+
+  GIVEN("the checks switched off"){
+    using pool_type = maybe_guarded_stack_pool<false, int, uint32_t>;
+    REQUIRE(std::is_same<pool_type, stack_pool<int, uint32_t>>::value);
+  }
+}
+
+SCENARIO("watching how the pool is used"){
+  GIVEN("a pool after some churn"){
+    stack_pool<int, uint32_t> pool{};
+    auto l1 = pool.new_stack();
+    auto l2 = pool.new_stack();
+    for(int i = 0; i < 20; ++i){
+      l1 = pool.push(i, l1);
+      l2 = pool.push(i, l2);
+    }
+    std::vector<int> out(5);
+    l1 = pool.pop_n(l1, 5, out.begin());
+    l2 = pool.pop(l2);
+
+    THEN("the counters follow every operation"){
+      const auto& c = pool.counters();
+      REQUIRE(c.live == 34);
+      REQUIRE(c.peak_live == 40);
+      REQUIRE(c.growths == 4); // 8, 16, 32, 64
+      REQUIRE(c.bytes_moved == (8 + 16 + 32) * 2 * sizeof(uint32_t));
+      l1 = pool.push_range(out.begin(), out.end(), l1);
+      REQUIRE(c.live == 39);
+      l2 = pool.free_stack(l2);
+      REQUIRE(c.live == 20);
+      pool.clear();
+      REQUIRE(c.live == 0);
+      REQUIRE(c.peak_live == 40);
+    }
+
+    THEN("a scan finds the free nodes and the hops of each stack"){
+      const std::vector<uint32_t> heads{l1, l2};
+      const auto r = pool.stats(heads.begin(), heads.end());
+      REQUIRE(r.live == 34);
+      REQUIRE(r.used == 40);
+      REQUIRE(r.free == 6);
+      REQUIRE(r.capacity == pool.capacity());
+      REQUIRE(r.locality.size() == 2);
+      REQUIRE(r.locality[0][1] == 14); // every hop jumps over a node of the other stack
+      REQUIRE(r.locality[1][1] == 18);
+    }
+
+    WHEN("a chain of known length is freed"){
+      auto l = pool.new_stack();
+      l = pool.push(0, l);
+      const auto tail = l;
+      for(int i = 1; i < 10; ++i)
+        l = pool.push(i, l);
+      REQUIRE(pool.counters().live == 44);
+      l = pool.free_stack(l, tail, 10);
+      REQUIRE(pool.counters().live == 34);
+      REQUIRE(pool.stats().free == 10); // 6 were recycled, 4 are new
+    }
+  }
+}
+
+SCENARIO("allocating the nodes of standard containers from the pools"){
+  // counts what reaches the resource below
+  struct counting_resource: std::pmr::memory_resource{
+    std::size_t allocated{0}, deallocated{0};
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+      ++allocated;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+      ++deallocated;
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& x) const noexcept override { return this == &x; }
+  };
+
+  GIVEN("a resource on top of a counting one"){
+    counting_resource upstream;
+    pool_memory_resource<> r{&upstream};
+
+    THEN("a freed block is the next one handed out, and the chunk stays"){
+      auto a = r.allocate(24);
+      auto b = r.allocate(24);
+      REQUIRE(a != b);
+      REQUIRE(r.in_use(24) == 2);
+      r.deallocate(a, 24);
+      REQUIRE(r.in_use(32) == 1); // same block size
+      REQUIRE(r.allocate(32) == a);
+      REQUIRE(upstream.allocated == 1);
+      auto c = r.allocate(100);
+      REQUIRE(upstream.allocated == 2); // another block size, another chunk
+      r.deallocate(c, 100);
+      r.deallocate(b, 24);
+      r.deallocate(a, 32);
+      REQUIRE(upstream.deallocated == 0);
+      r.release();
+      REQUIRE(upstream.deallocated == 2);
+    }
+
+    THEN("big and over-aligned requests go upstream"){
+      auto a = r.allocate(1000);
+      auto b = r.allocate(16, 64);
+      REQUIRE(upstream.allocated == 2);
+      REQUIRE(reinterpret_cast<std::uintptr_t>(b) % 64 == 0);
+      REQUIRE(r.in_use(1000) == 0); // not in any pool
+      r.deallocate(a, 1000);
+      r.deallocate(b, 16, 64);
+      REQUIRE(upstream.deallocated == 2);
+    }
+
+    WHEN("a map churns through many chunks"){
+      std::pmr::map<int, int> m{&r};
+      std::map<int, int> expected;
+      for(int i = 0; i < 50000; ++i){
+        const int k = i * 7919 % 20011;
+        if(i % 3 == 2){
+          m.erase(k);
+          expected.erase(k);
+        } else {
+          m[k] = i;
+          expected[k] = i;
+        }
+      }
+      THEN("it holds what a map on the heap holds"){
+        REQUIRE(std::equal(m.begin(), m.end(), expected.begin(), expected.end()));
+        m.clear();
+        REQUIRE(upstream.deallocated == 0);
+      }
+    }
+  }
+
+  GIVEN("a resource handing out the lowest free block"){
+    pool_memory_resource<std::uint32_t, bitmap_free_slots> r;
+    std::vector<void*> blocks;
+    for(int i = 0; i < 100; ++i)
+      blocks.push_back(r.allocate(48));
+    r.deallocate(blocks[70], 48);
+    r.deallocate(blocks[10], 48);
+    REQUIRE(r.allocate(48) == blocks[10]);
+    REQUIRE(r.allocate(48) == blocks[70]);
+    for(auto b : blocks)
+      r.deallocate(b, 48);
+    REQUIRE(r.in_use(48) == 0);
+  }
+}
+
+SCENARIO("queues sharing a pool"){
+  GIVEN("two queues"){
+    queue_pool<int, uint32_t> pool{};
+    auto q1 = pool.new_queue();
+    auto q2 = pool.new_queue();
+    REQUIRE(pool.empty(q1));
+    for(int i = 0; i < 5; ++i){
+      q1 = pool.enqueue(i, q1);
+      q2 = pool.enqueue(10 + i, q2);
+    }
+
+    THEN("values come out in the order they went in"){
+      REQUIRE(pool.front(q1) == 0);
+      REQUIRE(pool.back(q1) == 4);
+      for(int i = 0; i < 5; ++i){
+        REQUIRE(pool.front(q1) == i);
+        REQUIRE(pool.size(q1) == std::size_t(5 - i));
+        q1 = pool.dequeue(q1);
+      }
+      REQUIRE(pool.size(q1) == 0);
+      REQUIRE(pool.empty(q1));
+      REQUIRE(q1 == pool.new_queue());
+      q1 = pool.enqueue(42, q1);
+      REQUIRE(pool.front(q1) == 42);
+      REQUIRE(pool.back(q1) == 42);
+    }
+
+    THEN("a dequeued node is recycled by any queue"){
+      const auto f = q1.front;
+      q1 = pool.dequeue(q1);
+      q2 = pool.enqueue(99, q2);
+      REQUIRE(q2.back == f);
+      REQUIRE(pool.prev(q2.back) == 10);
+      REQUIRE(pool.prev(q1.front) == pool.end());
+    }
+
+    THEN("the iterators go both ways"){
+      const std::vector<int> forward(pool.cbegin(q1), pool.cend(q1));
+      REQUIRE(forward == std::vector<int>{0, 1, 2, 3, 4});
+      const std::vector<int> backward(pool.rbegin(q2), pool.rend(q2));
+      REQUIRE(backward == std::vector<int>{14, 13, 12, 11, 10});
+      auto it = pool.end(q1);
+      REQUIRE(*--it == 4);
+      REQUIRE(*std::prev(it, 2) == 2);
+      REQUIRE(std::distance(pool.begin(q1), pool.end(q1)) == 5);
+    }
+
+    WHEN("they are concatenated"){
+      const auto capacity = pool.capacity();
+      auto q = pool.concat(q1, q2);
+      THEN("no node moves and the links join in both directions"){
+        REQUIRE(pool.capacity() == capacity);
+        REQUIRE(std::equal(pool.begin(q), pool.end(q), std::vector<int>{0, 1, 2, 3, 4, 10, 11, 12, 13, 14}.begin()));
+        const std::vector<int> backward(pool.rbegin(q), pool.rend(q));
+        REQUIRE(backward == std::vector<int>{14, 13, 12, 11, 10, 4, 3, 2, 1, 0});
+        REQUIRE(pool.concat(q, pool.new_queue()) == q);
+        REQUIRE(pool.concat(pool.new_queue(), q) == q);
+        REQUIRE(pool.size(q) == 10);
+        q = pool.free_queue(q);
+        REQUIRE(pool.counters().live == 0);
+      }
+    }
+  }
+
+  GIVEN("values that own memory"){
+    queue_pool<std::unique_ptr<int>, uint16_t> pool{};
+    auto q = pool.new_queue();
+    for(int i = 0; i < 100; ++i)
+      q = pool.emplace(q, new int{i});
+    for(int i = 0; i < 50; ++i)
+      q = pool.dequeue(q);
+    REQUIRE(*pool.front(q) == 50);
+    REQUIRE(pool.counters().live == 50);
+    q = pool.free_queue(q);
+    REQUIRE(pool.counters().live == 0);
+  }
+}
+
+SCENARIO("branching stacks that share their tails"){
+  GIVEN("a trunk and two branches pushed on it"){
+    persistent_stack_pool<int, uint32_t> pool{};
+    auto trunk = pool.new_stack();
+    for(int i = 0; i < 10; ++i){
+      const auto l = pool.push(i, trunk);
+      pool.release(trunk);
+      trunk = l;
+    }
+    const auto a = pool.push(100, trunk);
+    const auto b = pool.push(200, trunk);
+
+    THEN("the branches see the trunk, and nothing is copied"){
+      REQUIRE(pool.counters().live == 12);
+      REQUIRE(pool.next(a) == trunk);
+      REQUIRE(pool.next(b) == trunk);
+      REQUIRE(pool.use_count(trunk) == 3);
+      REQUIRE(std::distance(pool.begin(a), pool.end(a)) == 11);
+      REQUIRE(*std::max_element(pool.cbegin(b), pool.cend(b)) == 200);
+      REQUIRE(pool.value(pool.next(trunk)) == 8);
+    }
+
+    WHEN("the handles are released"){
+      REQUIRE(pool.release(trunk) == 0); // still under a and b
+      REQUIRE(pool.release(a) == 1);
+      REQUIRE(pool.counters().live == 11);
+      REQUIRE(pool.value(pool.next(b)) == 9);
+      REQUIRE(pool.release(b) == 11); // the last owner takes the trunk with it
+      REQUIRE(pool.counters().live == 0);
+    }
+
+    WHEN("a branch is popped"){
+      const auto c = pool.share(a);
+      const auto below = pool.pop(a);
+      REQUIRE(below == trunk);
+      REQUIRE(pool.value(c) == 100); // a is still alive through c
+      REQUIRE(pool.use_count(trunk) == 4);
+      pool.release(c);
+      REQUIRE(pool.use_count(trunk) == 3);
+      pool.release(below);
+      pool.release(b);
+      pool.release(trunk);
+      REQUIRE(pool.counters().live == 0);
+    }
+  }
+
+  GIVEN("values that own memory"){
+    persistent_stack_pool<std::unique_ptr<int>, uint16_t> pool{};
+    auto l = pool.emplace(pool.new_stack(), new int{1});
+    const auto m = pool.emplace(l, new int{2});
+    pool.release(l);
+    REQUIRE(**pool.begin(pool.next(m)) == 1);
+    REQUIRE(pool.release(m) == 2);
+    REQUIRE(pool.counters().live == 0);
+  }
+}
+
+SCENARIO("collecting the stacks nobody frees"){
+  GIVEN("a pool where some heads have been dropped"){
+    stack_pool<std::shared_ptr<int>, uint32_t> pool{};
+    auto tracked = std::make_shared<int>(0);
+    std::vector<uint32_t> heads(20, pool.new_stack());
+    for(int i = 0; i < 2000; ++i)
+      heads[std::size_t(i % 20)] = pool.push(tracked, heads[std::size_t(i % 20)]);
+    heads[3] = pool.pop(heads[3]);
+    heads[7] = pool.free_stack(heads[7]);
+    std::vector<uint32_t> kept;
+    for(std::size_t k = 0; k < heads.size(); k += 2)
+      kept.push_back(heads[k]); // the odd ones are lost
+    const auto live = pool.counters().live;
+
+    THEN("the lost nodes are freed and their values destroyed"){
+      const auto c = pool.collect(kept.begin(), kept.end(), 1);
+      REQUIRE(c.reclaimed == 9 * 100 - 1);
+      REQUIRE(c.seconds >= 0);
+      REQUIRE(pool.counters().live == live - c.reclaimed);
+      REQUIRE(tracked.use_count() == long(1 + pool.counters().live));
+      REQUIRE(pool.stats().free == 2000 - pool.counters().live);
+      for(auto h : kept)
+        REQUIRE(std::distance(pool.begin(h), pool.end(h)) == 100);
+    }
+
+    THEN("the free nodes are recycled from the lowest address"){
+      pool.collect(kept.begin(), kept.end());
+      REQUIRE(pool.push(tracked, pool.new_stack()) == 2); // heads[1] took node 2
+      REQUIRE(pool.collect(kept.begin(), kept.end()).reclaimed == 1);
+    }
+
+    THEN("marking in parallel finds the same nodes"){
+      auto copy = pool;
+      const auto c = pool.collect(kept.begin(), kept.end(), 1);
+      kept.push_back(kept.front()); // a stack met twice is marked once
+      const auto d = copy.collect(kept.begin(), kept.end(), 4);
+      REQUIRE(c.reclaimed == d.reclaimed);
+      REQUIRE(pool.stats().free == copy.stats().free);
+      REQUIRE(copy.collect(kept.begin(), kept.end(), 4).reclaimed == 0);
+    }
+  }
+}
+
+SCENARIO("trying moves and taking them back"){
+  GIVEN("two stacks and a checkpoint"){
+    stack_pool<std::shared_ptr<int>, uint32_t> pool{};
+    auto tracked = std::make_shared<int>(0);
+    auto l1 = pool.new_stack();
+    auto l2 = pool.new_stack();
+    for(int i = 0; i < 10; ++i){
+      l1 = pool.push(std::make_shared<int>(i), l1);
+      l2 = pool.push(std::make_shared<int>(10 + i), l2);
+    }
+    const auto old1 = l1, old2 = l2;
+    const auto before = pool.stats();
+    auto cp = pool.checkpoint();
+    l1 = pool.pop(pool.pop(l1));
+    l1 = pool.push(tracked, l1);
+    l2 = pool.free_stack(l2);
+    auto l3 = pool.push(tracked, pool.new_stack());
+    l3 = pool.push(tracked, l3);
+
+    THEN("popped values wait until the end of the checkpoint"){
+      REQUIRE(*pool.value(old1) == 9);
+      REQUIRE(pool.counters().live == 23);
+      REQUIRE(tracked.use_count() == 4);
+    }
+
+    WHEN("it is rolled back"){
+      pool.rollback(cp);
+      THEN("the old heads see what they saw, the pushed nodes are free again"){
+        REQUIRE(tracked.use_count() == 1);
+        REQUIRE(pool.counters().live == 20);
+        std::vector<int> v;
+        for(auto x = pool.begin(old2); x != pool.end(old2); ++x)
+          v.push_back(**x);
+        REQUIRE(v == std::vector<int>{19, 18, 17, 16, 15, 14, 13, 12, 11, 10});
+        REQUIRE(std::distance(pool.begin(old1), pool.end(old1)) == 10);
+        REQUIRE(pool.stats().free == before.free + 3);
+        REQUIRE_THROWS_AS(pool.rollback(cp), std::invalid_argument);
+      }
+    }
+
+    WHEN("it is committed"){
+      pool.commit(cp);
+      THEN("the new heads stay and the popped nodes are freed"){
+        REQUIRE(pool.counters().live == 11);
+        REQUIRE(tracked.use_count() == 4);
+        REQUIRE(*pool.value(l1) == 0);
+        REQUIRE(*pool.value(pool.next(l1)) == 7);
+        REQUIRE(pool.stats().free == 12);
+        REQUIRE_THROWS_AS(pool.commit(cp), std::invalid_argument);
+      }
+    }
+
+    WHEN("checkpoints nest"){
+      const auto l1_outer = l1;
+      auto inner = pool.checkpoint();
+      l1 = pool.pop(l1);
+      l1 = pool.push(tracked, l1);
+      pool.commit(inner); // nothing is freed yet
+      REQUIRE(pool.counters().live == 24);
+      REQUIRE(*pool.value(l1_outer) == 0);
+      auto again = pool.checkpoint();
+      pool.free_stack(l3);
+      pool.rollback(again);
+      REQUIRE(std::distance(pool.begin(l3), pool.end(l3)) == 2);
+      pool.rollback(cp);
+      REQUIRE(tracked.use_count() == 1);
+      REQUIRE(pool.counters().live == 20);
+    }
+
+    THEN("the operations that cannot be undone are refused"){
+      std::vector<std::shared_ptr<int>> out(2);
+      REQUIRE_THROWS_AS(pool.pop_n(l1, 2, out.begin()), std::logic_error);
+      const std::vector<uint32_t> heads{l1};
+      REQUIRE_THROWS_AS(pool.compact(heads.begin(), heads.end()), std::logic_error);
+      REQUIRE_THROWS_AS(pool.collect(heads.begin(), heads.end()), std::logic_error);
+      pool.rollback(cp);
+      REQUIRE_NOTHROW(pool.pop_n(old1, 2, out.begin()));
+    }
+  }
+
+  GIVEN("a long speculative run on a pool of ints"){
+    stack_pool<int, uint32_t, vector_storage, vector_storage::growth, bitmap_free_slots> pool{};
+    auto l = pool.new_stack();
+    for(int i = 0; i < 100; ++i)
+      l = pool.push(i, l);
+    const auto cp = pool.checkpoint();
+    auto s = l;
+    for(int i = 0; i < 1000; ++i)
+      s = i % 3 == 2 ? pool.pop(s) : pool.push_range(&i, &i + 1, s);
+    pool.rollback(cp);
+    REQUIRE(pool.counters().live == 100);
+    REQUIRE(*std::max_element(pool.begin(l), pool.end(l)) == 99);
+    REQUIRE(std::distance(pool.begin(l), pool.end(l)) == 100);
+    REQUIRE(pool.stats().free == pool.stats().used - 100);
+  }
+}
+
+SCENARIO("passing stacks between threads that own their nodes"){
+  GIVEN("a pool segmented so that its nodes never move"){
+    stack_pool<int, uint32_t, segmented_storage<>> pool{};
+    auto l = pool.new_stack();
+    l = pool.push(0, l);
+    const int* first = &pool.value(l);
+    for(int i = 1; i < 1000; ++i)
+      l = pool.push(i, l);
+    REQUIRE(&pool.value(1) == first);
+    REQUIRE(pool.capacity() == 1016); // 8 + 16 + ... + 512
+    auto copy = pool;
+    REQUIRE(std::equal(pool.begin(l), pool.end(l), copy.begin(l), copy.end(l)));
+    l = pool.free_stack(l);
+    pool.shrink_to_fit();
+    REQUIRE(pool.capacity() == 0);
+  }
+
+  GIVEN("two shards used by one thread"){
+    sharded_stack_pool<std::shared_ptr<int>, uint32_t, 4> pool{2};
+    auto a = pool.shard(0);
+    auto b = pool.shard(1);
+    auto tracked = std::make_shared<int>(7);
+    auto l = a.new_stack();
+    for(int i = 0; i < 300; ++i)
+      l = a.push(tracked, l);
+    l = b.push(tracked, l); // a stack across the shards
+
+    THEN("the addresses say which shard holds a node"){
+      REQUIRE(l >> 28 == 1);
+      REQUIRE(pool.next(l) >> 28 == 0);
+      REQUIRE(*pool.value(l) == 7);
+      REQUIRE(std::distance(pool.cbegin(l), pool.cend(l)) == 301);
+    }
+
+    THEN("a foreign node is freed by its owner, in batches"){
+      l = b.free_stack(l);
+      REQUIRE(b.counters().live == 0); // its own node, at once
+      REQUIRE(tracked.use_count() == 301);
+      REQUIRE(a.drain() == 256); // a full batch was posted
+      REQUIRE(tracked.use_count() == 45);
+      b.flush();
+      REQUIRE(a.drain() == 44);
+      REQUIRE(a.counters().live == 0);
+      REQUIRE(tracked.use_count() == 1);
+    }
+
+    THEN("a push drains what has been posted"){
+      b.free_stack(l);
+      b.flush();
+      a.push(tracked, a.new_stack());
+      REQUIRE(a.counters().live == 1);
+    }
+  }
+
+  GIVEN("shards of 255 nodes"){
+    sharded_stack_pool<int, uint16_t, 8> pool{2};
+    auto b = pool.shard(1);
+    auto l = b.new_stack();
+    for(int i = 0; i < 255; ++i)
+      l = b.push(i, l);
+    THEN("a full shard refuses a push before it builds anything"){
+      REQUIRE(l == (1 << 8 | 255));
+      REQUIRE_THROWS_AS( b.push(255, l), std::length_error );
+      REQUIRE_THROWS_AS( b.push(255, l), std::length_error );
+      REQUIRE(b.counters().live == 255);
+      REQUIRE(b.counters().growths == 6); // the last one asks for 255 nodes, not 496
+      l = b.pop(l);
+      REQUIRE(b.push(42, l) == (1 << 8 | 255));
+    }
+  }
+
+  GIVEN("producers and consumers"){
+    constexpr std::size_t n_threads = 4, rounds = 500, depth = 20;
+    sharded_stack_pool<int> pool{n_threads};
+    std::mutex m;
+    std::vector<std::size_t> mailbox; // the heads, passed under the mutex
+    std::vector<long> sums(n_threads);
+    std::vector<std::thread> threads;
+    for(std::size_t t = 0; t < n_threads; ++t)
+      threads.emplace_back([&pool, &m, &mailbox, &sums, t]{
+        auto s = pool.shard(t);
+        for(std::size_t r = 0; r < rounds; ++r){
+          auto l = s.new_stack();
+          for(std::size_t i = 0; i < depth; ++i)
+            l = s.push(int(i), l);
+          std::size_t other = s.end();
+          {
+            std::lock_guard<std::mutex> lock{m};
+            mailbox.push_back(l);
+            other = mailbox.front();
+            mailbox.erase(mailbox.begin());
+          }
+          for(; !s.empty(other); other = s.pop(other))
+            sums[t] += s.value(other);
+        }
+        s.flush();
+      });
+    for(auto& t : threads)
+      t.join();
+    THEN("every value is read once and every node comes back"){
+      long total = 0;
+      for(auto x : sums)
+        total += x;
+      REQUIRE(total == long(n_threads * rounds * depth * (depth - 1) / 2));
+      for(std::size_t t = 0; t < n_threads; ++t){
+        auto s = pool.shard(t);
+        s.drain();
+        REQUIRE(s.counters().live == 0);
+      }
+    }
+  }
+}
+
+SCENARIO("reading the stacks while the writer changes them"){
+  GIVEN("a stack read through a snapshot"){
+    snapshot_stack_pool<std::shared_ptr<int>, uint32_t> pool{2};
+    auto tracked = std::make_shared<int>(3);
+    auto l = pool.new_stack();
+    for(int i = 0; i < 10; ++i)
+      l = pool.push(tracked, l);
+    snapshot_stack_pool<std::shared_ptr<int>, uint32_t>::reader r{pool};
+
+    WHEN("the writer pops and frees while the snapshot is pinned"){
+      const auto old = l;
+      auto s = r.pin();
+      REQUIRE_THROWS_AS( r.pin(), std::logic_error );
+      l = pool.pop(l);
+      l = pool.pop(l);
+      REQUIRE(pool.reclaim() == 0);
+      l = pool.free_stack(l);
+      REQUIRE(pool.reclaim() == 0);
+      THEN("the snapshot still sees the stack as it was"){
+        REQUIRE(std::distance(s.begin(old), s.end(old)) == 10);
+        REQUIRE(std::all_of(s.begin(old), s.end(old), [](const std::shared_ptr<int>& p){ return *p == 3; }));
+        REQUIRE(pool.retired_nodes() == 10);
+        REQUIRE(tracked.use_count() == 11);
+      }
+      AND_WHEN("the snapshot is dropped"){
+        { auto gone = std::move(s); }
+        THEN("the nodes are recycled"){
+          REQUIRE(pool.reclaim() == 10);
+          REQUIRE(pool.retired_nodes() == 0);
+          REQUIRE(pool.counters().live == 0);
+          REQUIRE(tracked.use_count() == 1);
+          l = pool.push(tracked, l);
+          REQUIRE(pool.counters().peak_live == 10); // a recycled node
+        }
+      }
+    }
+
+    WHEN("a snapshot is pinned after the epoch of a pop is over"){
+      snapshot_stack_pool<std::shared_ptr<int>, uint32_t>::reader old{pool};
+      auto s = old.pin();
+      l = pool.pop(l);
+      REQUIRE(pool.reclaim() == 0);
+      auto late = r.pin();
+      THEN("only the older snapshot holds the node"){
+        { auto gone = std::move(s); }
+        REQUIRE(pool.reclaim() == 1);
+      }
+    }
+
+    THEN("there is room for so many readers"){
+      snapshot_stack_pool<std::shared_ptr<int>, uint32_t>::reader second{pool};
+      REQUIRE_THROWS_AS( (snapshot_stack_pool<std::shared_ptr<int>, uint32_t>::reader{pool}), std::length_error );
+    }
+  }
+
+  GIVEN("a writer and readers in threads"){
+    // the stack always holds k-1, ..., 1, 0 for some k
+    snapshot_stack_pool<int, uint32_t> pool{};
+    std::atomic<uint32_t> published{pool.new_stack()};
+    std::atomic<bool> done{false};
+    std::atomic<std::size_t> broken{0}, walks{0}, started{0};
+    std::vector<std::thread> readers;
+    for(int t = 0; t < 3; ++t)
+      readers.emplace_back([&]{
+        snapshot_stack_pool<int, uint32_t>::reader r{pool};
+        ++started;
+        do{ // at least one walk, even if the writer is done already
+          auto s = r.pin();
+          const auto l = published.load(std::memory_order_acquire);
+          int expected = s.empty(l) ? -1 : s.value(l);
+          for(auto it = s.cbegin(l); it != s.cend(l); ++it)
+            if(*it != expected--)
+              ++broken;
+          if(expected != -1 && !s.empty(l))
+            ++broken;
+          ++walks;
+        } while(!done.load());
+      });
+    while(started < readers.size()) // every reader is registered
+      std::this_thread::yield();
+    auto l = pool.new_stack();
+    int k = 0;
+    for(int step = 0; step < 20000; ++step){
+      if(k < 50 && (step / 100) % 2 == 0)
+        l = pool.push(k++, l);
+      else if(k > 0){
+        l = pool.pop(l);
+        --k;
+      }
+      published.store(l, std::memory_order_release);
+      pool.reclaim();
+    }
+    done = true;
+    for(auto& t : readers)
+      t.join();
+    pool.reclaim();
+    THEN("no reader ever sees a node recycled"){
+      REQUIRE(walks >= readers.size());
+      REQUIRE(broken == 0);
+      REQUIRE(pool.counters().live == std::size_t(k));
+      REQUIRE(pool.retired_nodes() == 0);
+    }
+  }
+}
+
+SCENARIO("walking many stacks at once"){
+  GIVEN("stacks pushed in turns, some of them empty"){
+    stack_pool<int, uint32_t, soa_storage> pool{};
+    std::vector<uint32_t> heads(50, pool.new_stack());
+    for(int i = 0; i < 2000; ++i){
+      const auto s = std::size_t(i * 7 % 47); // 47, 48 and 49 stay empty
+      heads[s] = pool.push(i * 31 % 1009, heads[s]);
+    }
+    std::swap(heads[0], heads[48]);
+
+    for(std::size_t width : {1, 3, 16, 100}){
+      WHEN("they are walked " + std::to_string(width) + " at a time"){
+        std::vector<std::vector<int>> seen(heads.size());
+        std::vector<int> maxima(heads.size(), -1);
+        pool.for_each_stack(heads.begin(), heads.end(), [&seen, &maxima](const std::size_t k, const int v){
+          seen[k].push_back(v);
+          maxima[k] = std::max(maxima[k], v);
+        }, width);
+        THEN("each one is visited from top to bottom"){
+          for(std::size_t k = 0; k < heads.size(); ++k){
+            REQUIRE(seen[k] == std::vector<int>(pool.cbegin(heads[k]), pool.cend(heads[k])));
+            if(!pool.empty(heads[k]))
+              REQUIRE(maxima[k] == *std::max_element(pool.cbegin(heads[k]), pool.cend(heads[k])));
+          }
+        }
+      }
+    }
+
+    THEN("no stack, no call"){
+      std::size_t calls = 0;
+      pool.for_each_stack(heads.begin(), heads.begin(), [&calls](std::size_t, int){ ++calls; });
+      pool.for_each_stack(heads.begin(), heads.begin() + 1, [&calls](std::size_t, int){ ++calls; });
+      pool.for_each_stack(heads.begin() + 49, heads.end(), [&calls](std::size_t, int){ ++calls; });
+      REQUIRE(calls == 0);
+    }
+  }
+}
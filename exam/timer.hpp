@@ -0,0 +1,17 @@
+#pragma once
+
+#include <chrono>
+
+// adapted from c++/10_efficient_programming/count_operations/timer.hpp:
+// stop() returns the elapsed seconds instead of printing them, so that the
+// benchmarks can turn them into ns/op
+template <typename Clock = std::chrono::steady_clock>
+class timer {
+  typename Clock::time_point t0;
+
+ public:
+  void start() { t0 = Clock::now(); }
+  double stop() const {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+  }
+};